@@ -1,13 +1,30 @@
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <new>
+#include <thread>
+#include <utility>
+
+// SSE2 is always available on x86-64, AVX2 is detected at runtime.
+// Define NO_SIMD to only use the scalar code.
+#if !defined(NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#define CSTRING_SIMD
+#include <immintrin.h>
+#endif
 
 #include "CString.h"
 
 const CString::size_type CString::DEFAULT_CAPACITY = 64;
+const CStringArena::size_type CStringArena::DEFAULT_BLOCK_SIZE = 64*1024;
 const char CString::DEFAULT_PAD_CHAR = ' ';
 const CString::size_type CString::NPOS = 0xffffffff;
 const CString CStringTokenizer::whitespace = " \t";
+const CString::size_type CStringTokenizer::MIN_SPLIT_REGION = 256*1024;
+const CString::size_type CStringStreamTokenizer::DEFAULT_CHUNK_SIZE = 64*1024;
+CString::GrowthPolicy CString::defaultGrowthPolicy_ = CString::GROWTH_LINEAR;
 
 
 //----------------------------------------------------------------------
@@ -21,7 +38,9 @@ const CString CStringTokenizer::whitespace = " \t";
   */
 CStringBaseIterator::CStringBaseIterator() :
     data_(NULL),
-    index_(-1)
+    index_(-1),
+    begin_(0),
+    end_(0)
 {
 }
 
@@ -30,39 +49,75 @@ CStringBaseIterator::CStringBaseIterator() :
   */
 CStringBaseIterator::CStringBaseIterator(const CString &str) :
     data_(str.data_),
-    index_(0)
+    index_(0),
+    begin_(0),
+    end_(str.size())
 {
   if(data_ != NULL)
   {
-    data_->references_++;
+    data_->addReference();
+  }
+  else
+  {
+    // Inline strings have no shared data to refer to, so take a private copy
+    data_ = CStringData::create(str.str(), str.size(), str.size());
   }
 }
 
+/** @brief CStringBaseIterator
+  *
+  */
+CStringBaseIterator::CStringBaseIterator(const CStringView &view) :
+    CStringBaseIterator(view.str_)
+{
+  begin_ = view.offset_;
+  end_ = view.offset_ + view.length_;
+  index_ = begin_;
+}
+
 /** @brief CStringBaseIterator
   *
   */
 CStringBaseIterator::CStringBaseIterator(const CStringBaseIterator &copy) :
     data_(copy.data_),
-    index_(copy.index_)
+    index_(copy.index_),
+    begin_(copy.begin_),
+    end_(copy.end_)
 {
   if(data_ != NULL)
   {
-    data_->references_++;
+    data_->addReference();
   }
 }
 
+/** @brief CStringBaseIterator
+  *
+  */
+CStringBaseIterator::CStringBaseIterator(CStringBaseIterator &&movE) noexcept :
+    data_(movE.data_),
+    index_(movE.index_),
+    begin_(movE.begin_),
+    end_(movE.end_)
+{
+  movE.data_ = NULL;
+  movE.index_ = -1;
+}
+
 CStringBaseIterator::~CStringBaseIterator()
+{
+  releaseData();
+}
+
+// protected
+void CStringBaseIterator::releaseData()
 {
   if(data_ != NULL)
   {
-    if(data_->references_ < 2)
+    if(data_->releaseReference())
     {
-      delete data_;
-    }
-    else
-    {
-      data_->references_--;
+      CStringData::destroy(data_);
     }
+    data_ = NULL;
   }
 }
 
@@ -70,14 +125,37 @@ CStringBaseIterator::~CStringBaseIterator()
   *
   */
 #ifndef NO_OPERATORS
-void CStringBaseIterator::operator=(const CStringBaseIterator &copy)
+CStringBaseIterator &CStringBaseIterator::operator=(const CStringBaseIterator &copy)
 {
+    // Add the new reference first, in case its the same data
+    if(copy.data_ != NULL)
+    {
+      copy.data_->addReference();
+    }
+    releaseData();
+
     data_ = copy.data_;
     index_ = copy.index_;
-    if(data_ != NULL)
+    begin_ = copy.begin_;
+    end_ = copy.end_;
+
+    return *this;
+}
+
+CStringBaseIterator &CStringBaseIterator::operator=(CStringBaseIterator &&movE) noexcept
+{
+    if(this != &movE)
     {
-      data_->references_++;
+      releaseData();
+      data_ = movE.data_;
+      index_ = movE.index_;
+      begin_ = movE.begin_;
+      end_ = movE.end_;
+      movE.data_ = NULL;
+      movE.index_ = -1;
     }
+
+    return *this;
 }
 #endif
 
@@ -111,6 +189,14 @@ CStringIterator::CStringIterator(const CString &str) :
 {
 }
 
+/** @brief CStringIterator
+  *
+  */
+CStringIterator::CStringIterator(const CStringView &view) :
+    CStringBaseIterator(view)
+{
+}
+
 /** @brief CStringIterator
   *
   */
@@ -130,7 +216,7 @@ const char CStringIterator::next()
 {
   isValidThrow();
 
-  return data_->str_[index_++];
+  return data_->str()[index_++];
 }
 
 /** @brief hasNext
@@ -143,14 +229,14 @@ bool CStringIterator::hasNext() const
     return false;
   }
 
-  return (index_ < data_->size_);
+  return (index_ < end_);
 }
 
 void CStringIterator::reset()
 {
   isValidThrow();
 
-  index_ = 0;
+  index_ = begin_;
 }
 
 //----------------------------------------------------------------------
@@ -174,7 +260,16 @@ CStringReverseIterator::CStringReverseIterator()
 CStringReverseIterator::CStringReverseIterator(const CString &str) :
     CStringBaseIterator(str)
 {
-  index_ = str.size()-1;
+  index_ = end_-1;
+}
+
+/** @brief CStringReverseIterator
+  *
+  */
+CStringReverseIterator::CStringReverseIterator(const CStringView &view) :
+    CStringBaseIterator(view)
+{
+  index_ = end_-1;
 }
 
 /** @brief CStringReverseIterator
@@ -196,7 +291,7 @@ const char CStringReverseIterator::next()
 {
   isValidThrow();
 
-  return data_->str_[index_--];
+  return data_->str()[index_--];
 }
 
 /** @brief hasNext
@@ -209,857 +304,4550 @@ bool CStringReverseIterator::hasNext() const
     return false;
   }
 
-  return (index_ > -1);
+  return (index_ >= begin_);
 }
 
 void CStringReverseIterator::reset()
 {
   isValidThrow();
 
-  index_ = data_->size_ - 1;
+  index_ = end_ - 1;
 }
 
 //----------------------------------------------------------------------
 //
-//    CStringTokenizer implementation
+//    CStringArena implementation
 //
 //----------------------------------------------------------------------
 
-CStringTokenizer::CStringTokenizer(const char *str, const char *token) :
-    inputStr_(str),
-    token_(token),
-    index_(0)
+// All allocations are rounded up to this, enough for a CStringData
+static inline CStringArena::size_type arenaAlign(CStringArena::size_type size)
 {
+  const CStringArena::size_type alignment = 2*sizeof(void *);
+  return (size + alignment - 1) & ~(alignment - 1);
 }
 
-CStringTokenizer::CStringTokenizer(const char *str, const CString &token) :
-    inputStr_(str),
-    token_(token),
-    index_(0)
+CStringArena::CStringArena(size_type blockSize) :
+    blocks_(NULL),
+    blockSize_(arenaAlign(blockSize)),
+    bytesUsed_(0),
+    bytesAllocated_(0)
 {
 }
 
-CStringTokenizer::CStringTokenizer(const CString &str, const char *token) :
-    inputStr_(str),
-    token_(token),
-    index_(0)
+CStringArena::~CStringArena()
 {
+  while(blocks_ != NULL)
+  {
+    Block *next = blocks_->next_;
+    free(blocks_);
+    blocks_ = next;
+  }
 }
 
-CStringTokenizer::CStringTokenizer(const CString &str, const CString &token) :
-    inputStr_(str),
-    token_(token),
-    index_(0)
+// private
+CStringArena::Block *CStringArena::newBlock(size_type size)
 {
-}
+  Block *block = static_cast<Block *>(malloc(sizeof(Block) + size));
+  if(block == NULL)
+  {
+    throw std::bad_alloc();
+  }
 
-// virtual
-CStringTokenizer::~CStringTokenizer()
-{
+  block->size_ = size;
+  block->used_ = 0;
+  bytesAllocated_ += size;
+
+  return block;
 }
 
-CString CStringTokenizer::next()
+void *CStringArena::allocate(size_type size)
 {
-  // Check if there are no more tokens
-  if(index_ == CString::NPOS)
-  {
-    return CString();
-  }
-
-  CString::size_type startIndex = index_;
-  CString::size_type endIndex = index_;
-  bool foundit = false;
+  size = arenaAlign(size);
 
-  // Find the end of the current string and null terminate it
-  for(int i = startIndex; i < inputStr_.size() && ! foundit; i++)
+  if(blocks_ == NULL || blocks_->used_ + size > blocks_->size_)
   {
-    CString::size_type index = token_.find(inputStr_.index(i));
-    if(index != CString::NPOS)
+    Block *block = newBlock((size > blockSize_) ? size : blockSize_);
+    if(blocks_ != NULL && size > blockSize_)
     {
-      //inputStr_.replace('\0', i, 1, 1);
-      endIndex = i;
-      foundit = true;
+      // Keep bumping in the current block, its probably not full
+      block->next_ = blocks_->next_;
+      blocks_->next_ = block;
+      block->used_ = size;
+      bytesUsed_ += size;
+      return block->data();
     }
+
+    block->next_ = blocks_;
+    blocks_ = block;
   }
 
-  // If the token wasnt found, either we're at the end of the string,
-  // or it didnt exist. Return from prevIndex to end of string
-  if(!foundit)
+  void *ptr = blocks_->data() + blocks_->used_;
+  blocks_->used_ += size;
+  bytesUsed_ += size;
+
+  return ptr;
+}
+
+bool CStringArena::extend(void *ptr, size_type oldSize, size_type newSize)
+{
+  oldSize = arenaAlign(oldSize);
+  newSize = arenaAlign(newSize);
+
+  // Only the most recent allocation in the current block can change size
+  if(blocks_ == NULL ||
+     static_cast<char *>(ptr) + oldSize != blocks_->data() + blocks_->used_ ||
+     blocks_->used_ - oldSize + newSize > blocks_->size_)
   {
-    index_ = CString::NPOS;
-    return inputStr_.substr(startIndex, CString::NPOS);
+    return false;
   }
 
-  // Now try to find the beginning of the next string and set index_ there
-  foundit = false;
-  for(int i = endIndex; i < inputStr_.size() && ! foundit; i++)
+  blocks_->used_ = blocks_->used_ - oldSize + newSize;
+  bytesUsed_ = bytesUsed_ - oldSize + newSize;
+
+  return true;
+}
+
+void CStringArena::reset()
+{
+  // Keep one standard size block for reuse, free the rest
+  Block *keep = NULL;
+  while(blocks_ != NULL)
   {
-    CString::size_type index = token_.find(inputStr_.index(i));
-    if(index == CString::NPOS)
+    Block *next = blocks_->next_;
+    if(keep == NULL && blocks_->size_ == blockSize_)
     {
-      foundit = true;
-      index_ = i;
+      keep = blocks_;
     }
+    else
+    {
+      bytesAllocated_ -= blocks_->size_;
+      free(blocks_);
+    }
+    blocks_ = next;
   }
 
-  if(!foundit)
+  if(keep != NULL)
   {
-    index_ = CString::NPOS;
+    keep->next_ = NULL;
+    keep->used_ = 0;
   }
 
-  return inputStr_.substr(startIndex, endIndex-startIndex);
+  blocks_ = keep;
+  bytesUsed_ = 0;
 }
 
-
 //----------------------------------------------------------------------
 //
-//    CStringData implementation
+//    CStringPool implementation
 //
 //----------------------------------------------------------------------
 
-CStringData::CStringData(CStringData::size_type initialCapacity, bool autoCapacity) :
-    references_(1),
-    initialCapacity_(initialCapacity),
-    capacity_(initialCapacity),
-    autoCapacity_(autoCapacity),
-    size_(0)
-{
-    // always make it 1 char larger for the end of line
-    str_ = new char[capacity_+1];
-    str_[0] = '\0';
-}
+CStringPool::size_type CStringPool::maxFreeBlocks_ = CStringPool::DEFAULT_MAX_FREE_BLOCKS;
 
-CStringData::CStringData(const char *str,
-                         CStringData::size_type initialCapacity,
-                         bool autoCapacity) :
-    references_(1),
-    initialCapacity_(initialCapacity),
-    capacity_(initialCapacity),
-    autoCapacity_(autoCapacity)
+// MIN_BLOCK_SIZE, 2*MIN_BLOCK_SIZE, ... MAX_BLOCK_SIZE
+static const int POOL_SIZE_CLASSES = 8;
+static const int POOL_NO_CLASS = -1;
+
+// The size class for a block, or POOL_NO_CLASS if its too big to be pooled
+static inline int poolSizeClass(CStringPool::size_type size)
 {
-  size_ = strlen(str);
-  if(size_ > capacity_)
+  if(size > CStringPool::MAX_BLOCK_SIZE)
   {
-    // TODO what if autoCapacity_ is false and the initial string is > than capacity?
-    capacity_ = size_;
+    return POOL_NO_CLASS;
   }
 
-  // always make it 1 char larger for the end of line
-  str_ = new char[capacity_+1];
-  memcpy(str_, str, size_);
-  str_[size_] = '\0';
-}
-
-CStringData::CStringData(const char *str,
-                         CStringData::size_type length,
-                         CStringData::size_type initialCapacity,
-                         bool autoCapacity) :
-    references_(1),
-    initialCapacity_(initialCapacity),
-    capacity_(initialCapacity),
-    autoCapacity_(autoCapacity)
-{
-  size_ = length;
-  if(size_ > capacity_)
+  int sizeClass = 0;
+  CStringPool::size_type classSize = CStringPool::MIN_BLOCK_SIZE;
+  while(classSize < size)
   {
-    // TODO what if autoCapacity_ is false and the initial string is > than capacity?
-    capacity_ = size_;
+    classSize <<= 1;
+    sizeClass++;
   }
 
-  // always make it 1 char larger for the end of line
-  str_ = new char[capacity_+1];
-  memcpy(str_, str, size_);
-  str_[size_] = '\0';
+  return sizeClass;
 }
 
-CStringData::~CStringData()
+static inline CStringPool::size_type poolClassSize(int sizeClass)
 {
-  delete [] str_;
+  return CStringPool::MIN_BLOCK_SIZE << sizeClass;
 }
 
-//----------------------------------------------------------------------
-//
-//    CString implementation
-//      Never allow a CString to have a null CStringData member
-//----------------------------------------------------------------------
+// A free block is linked through its first bytes
+struct CStringPoolBlock
+{
+  CStringPoolBlock *next_;
+};
 
-CString::CString(size_type initialCapacity, bool autoCapacity) : // defaults to CString::INITIAL_CAPACITY, true
-  padChar_(DEFAULT_PAD_CHAR)
+// The free lists of one thread, freed when the thread exits.
+// CStrings destroyed after that, static ones for example, are just freed.
+struct CStringPoolLists
 {
-  data_ = new CStringData(initialCapacity, autoCapacity);
-}
+  CStringPoolBlock *lists_[POOL_SIZE_CLASSES];
+  CStringPool::size_type counts_[POOL_SIZE_CLASSES];
+  bool closed_;
 
-CString::CString(const char *str, size_type initialCapacity, bool autoCapacity) : // defaults to CString::INITIAL_CAPACITY, true
-  padChar_(DEFAULT_PAD_CHAR)
+  CStringPoolLists() :
+    closed_(false)
+  {
+    memset(lists_, 0, sizeof(lists_));
+    memset(counts_, 0, sizeof(counts_));
+  }
+
+  ~CStringPoolLists()
+  {
+    trim();
+    closed_ = true;
+  }
+
+  void trim()
+  {
+    for(int i = 0; i < POOL_SIZE_CLASSES; i++)
+    {
+      while(lists_[i] != NULL)
+      {
+        CStringPoolBlock *next = lists_[i]->next_;
+        free(lists_[i]);
+        lists_[i] = next;
+      }
+      counts_[i] = 0;
+    }
+  }
+};
+
+static thread_local CStringPoolLists poolLists;
+
+// static
+void *CStringPool::allocate(size_type size)
 {
-  data_ = new CStringData(str, initialCapacity, autoCapacity);
+  int sizeClass = poolSizeClass(size);
+  if(sizeClass != POOL_NO_CLASS)
+  {
+    CStringPoolBlock *block = poolLists.lists_[sizeClass];
+    if(block != NULL)
+    {
+      poolLists.lists_[sizeClass] = block->next_;
+      poolLists.counts_[sizeClass]--;
+      return block;
+    }
+
+    size = poolClassSize(sizeClass);
+  }
+
+  void *block = malloc(size);
+  if(block == NULL)
+  {
+    throw std::bad_alloc();
+  }
+
+  return block;
 }
 
-CString::CString(const char *str, size_type length, size_type initialCapacity, bool autoCapacity) : // defaults to true
-  padChar_(DEFAULT_PAD_CHAR)
+// static
+CStringPool::size_type CStringPool::getBlockSize(size_type size)
 {
-  data_ = new CStringData(str, length, initialCapacity, autoCapacity);
+  int sizeClass = poolSizeClass(size);
+  return (sizeClass == POOL_NO_CLASS) ? size : poolClassSize(sizeClass);
 }
 
-CString::CString(const CString &copY) :
-  data_(NULL),
-  padChar_(DEFAULT_PAD_CHAR)
+// static
+void *CStringPool::reallocate(void *block, size_type oldSize, size_type newSize)
 {
-  copy(copY);
+  int oldClass = poolSizeClass(oldSize);
+  int newClass = poolSizeClass(newSize);
+
+  // The block is already big enough
+  if(oldClass == newClass && oldClass != POOL_NO_CLASS)
+  {
+    return block;
+  }
+
+  if(oldClass == POOL_NO_CLASS && newClass == POOL_NO_CLASS)
+  {
+    void *newBlock = realloc(block, newSize);
+    if(newBlock == NULL)
+    {
+      throw std::bad_alloc();
+    }
+    return newBlock;
+  }
+
+  // Moving between size classes, or in or out of the pooled sizes
+  void *newBlock = allocate(newSize);
+  memcpy(newBlock, block, (oldSize < newSize) ? oldSize : newSize);
+  release(block, oldSize);
+
+  return newBlock;
 }
 
-#ifndef NO_OPERATORS
-void CString::operator=(const CString &copY)
+// static
+void CStringPool::release(void *block, size_type size)
 {
-  copy(copY);
+  int sizeClass = poolSizeClass(size);
+  if(sizeClass == POOL_NO_CLASS ||
+     poolLists.closed_ ||
+     poolLists.counts_[sizeClass] >= maxFreeBlocks_)
+  {
+    free(block);
+    return;
+  }
+
+  CStringPoolBlock *poolBlock = static_cast<CStringPoolBlock *>(block);
+  poolBlock->next_ = poolLists.lists_[sizeClass];
+  poolLists.lists_[sizeClass] = poolBlock;
+  poolLists.counts_[sizeClass]++;
 }
-#endif
 
-CString::~CString()
+// static
+void CStringPool::trim()
 {
-  decrementReference();
+  poolLists.trim();
 }
 
-void CString::copy(const CString &copy)
+// static
+CStringPool::size_type CStringPool::getFreeBlocks()
 {
-  // Stop referring to the current data and refer to the data of another CString
-
-  // update the existing CStringData
-  if(data_ != NULL)
+  size_type count = 0;
+  for(int i = 0; i < POOL_SIZE_CLASSES; i++)
   {
-    decrementReference();
+    count += poolLists.counts_[i];
   }
 
-  // now setup a "new" CStringData
-  data_ = copy.data_;
-  data_->references_++;
+  return count;
+}
 
-  padChar_ = copy.padChar_;
+//----------------------------------------------------------------------
+//
+//    CStringData implementation
+//
+//----------------------------------------------------------------------
+
+CStringData::CStringData(CStringData::size_type length,
+                         CStringData::size_type capacity,
+                         CStringArena *arena) :
+    references_(1),
+    capacity_(capacity),
+    size_(length),
+    arena_(arena)
+{
+  invalidateHash();
 }
 
+CStringData::~CStringData()
+{
+}
 
-// private
-void CString::decrementReference()
+// static
+CStringData *CStringData::create(const char *str,
+                                 CStringData::size_type length,
+                                 CStringData::size_type capacity,
+                                 CStringArena *arena)
 {
-  if(data_->references_ < 2)
+  // always make it 1 char larger for the end of line
+  void *block;
+  if(arena != NULL)
   {
-    delete data_;
-    data_ = NULL;
+    block = arena->allocate(sizeof(CStringData) + capacity + 1);
   }
   else
   {
-    data_->references_--;
+    block = CStringPool::allocate(sizeof(CStringData) + capacity + 1);
   }
+
+  CStringData *data = new (block) CStringData(length, capacity, arena);
+  memcpy(data->str(), str, length);
+  data->str()[length] = '\0';
+
+  return data;
 }
 
-// private
-void CString::incrementCapacity(size_type size)
+// static
+CStringData *CStringData::resize(CStringData *data, CStringData::size_type capacity)
 {
-  if(!data_->autoCapacity_)
+  CStringArena *arena = data->arena_;
+  if(arena != NULL)
   {
-    throw CStringOutOfBoundsException(
-        "Trying to increment capacity with autoCapacity set false");
+    if(arena->extend(data, sizeof(CStringData) + data->capacity_ + 1,
+                           sizeof(CStringData) + capacity + 1))
+    {
+      data->capacity_ = capacity;
+      return data;
+    }
+
+    // The old block is left to be released with the arena
+    CStringData *newData = create(data->str(), data->size_, capacity, arena);
+    destroy(data);
+    return newData;
   }
 
-  size_type origCap = data_->capacity_;
-  // Check that we increment enough to hold the new string
-  data_->capacity_ += ((size > data_->initialCapacity_) ? size : data_->initialCapacity_);
+  // Pooled blocks often have room to grow, and realloc is used for large ones
+  void *block = CStringPool::reallocate(data,
+                                        sizeof(CStringData) + data->capacity_ + 1,
+                                        sizeof(CStringData) + capacity + 1);
 
-  if(data_ != NULL)
-  {
-    // TODO whats better: this way or using realloc?
+  data = static_cast<CStringData *>(block);
+  data->capacity_ = capacity;
+
+  return data;
+}
+
+CStringData::size_type CStringData::getBlockSize() const
+{
+  CStringData::size_type size = sizeof(CStringData) + capacity_ + 1;
+  return (arena_ != NULL) ? arenaAlign(size) : CStringPool::getBlockSize(size);
+}
+
+// static
+void CStringData::destroy(CStringData *data)
+{
+  CStringArena *arena = data->arena_;
+  CStringData::size_type capacity = data->capacity_;
+  data->~CStringData();
 
-    // always make it 1 char larger for the end of line
-    char *ptr = new char[data_->capacity_+1];
-    memcpy(ptr, data_->str_, origCap);
-    delete [] data_->str_;
-    data_->str_ = ptr;
+  // Arena blocks are released with the arena
+  if(arena == NULL)
+  {
+    CStringPool::release(data, sizeof(CStringData) + capacity + 1);
   }
 }
 
-void CString::toupper()
+//----------------------------------------------------------------------
+//
+//    Single char search kernels.
+//      Each returns the index of the first (or last) ch in ptr[0, length),
+//      or NPOS. findChar() and rfindChar() pick the fastest one available.
+//----------------------------------------------------------------------
+
+static CString::size_type findCharScalar(const char *ptr, CString::size_type length, char ch)
 {
-  for(int i = 0; i < size(); i++)
+  for(CString::size_type i = 0; i < length; i++)
   {
-    // ascii  hex   decimal
-    //   'a'  0x61   97
-    //   'z'  0x7a   122
-    //   'A'  0x41   65
-    //   'Z'  0x5a   90
-    //
-    if(data_->str_[i] >= 'a' && data_->str_[i] <= 'z')
+    if(ptr[i] == ch)
     {
-      data_->str_[i] -= 32;
+      return i;
     }
   }
+
+  return CString::NPOS;
 }
 
-void CString::tolower()
+static CString::size_type rfindCharScalar(const char *ptr, CString::size_type length, char ch)
 {
-  for(int i = 0; i < size(); i++)
+  for(CString::size_type i = length; i-- > 0; )
   {
-    // ascii  hex   decimal
-    //   'a'  0x61   97
-    //   'z'  0x7a   122
-    //   'A'  0x41   65
-    //   'Z'  0x5a   90
-    //
-    if(data_->str_[i] >= 'A' && data_->str_[i] <= 'Z')
+    if(ptr[i] == ch)
     {
-      data_->str_[i] += 32;
+      return i;
     }
   }
+
+  return CString::NPOS;
 }
 
-bool CString::isNumber() const
+#ifdef CSTRING_SIMD
+
+static CString::size_type findCharSse2(const char *ptr, CString::size_type length, char ch)
 {
-  if(empty())
+  const __m128i needle = _mm_set1_epi8(ch);
+  CString::size_type i = 0;
+
+  for( ; i + 16 <= length; i += 16)
   {
-    return false;
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if(mask != 0)
+    {
+      return i + __builtin_ctz(mask);
+    }
   }
 
-  // Get past the leading spaces
-  int i = 0;
-  while(data_->str_[i++] == ' ' && i < size()) {}
+  CString::size_type found = findCharScalar(ptr + i, length - i, ch);
+  return (found == CString::NPOS) ? found : i + found;
+}
 
-  bool trailingSpaces = false;
-  for(int j = i; j < size(); j++)
+static CString::size_type rfindCharSse2(const char *ptr, CString::size_type length, char ch)
+{
+  const __m128i needle = _mm_set1_epi8(ch);
+  CString::size_type i = length;
+
+  for( ; i >= 16; i -= 16)
   {
-    const char c = data_->str_[j];
-    if(c == ' ')
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i - 16));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    if(mask != 0)
     {
-      trailingSpaces = true; // "1234 "
+      return i - 16 + (31 - __builtin_clz(mask));
     }
-    else if(c < '0' || c > '9')
+  }
+
+  return rfindCharScalar(ptr, i, ch);
+}
+
+__attribute__((target("avx2")))
+static CString::size_type findCharAvx2(const char *ptr, CString::size_type length, char ch)
+{
+  const __m256i needle = _mm256_set1_epi8(ch);
+  CString::size_type i = 0;
+
+  for( ; i + 32 <= length; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    if(mask != 0)
     {
-      if(trailingSpaces)
-      {
-        return false; // "123 4"
-      }
+      return i + __builtin_ctz(mask);
+    }
+  }
 
-      if(c == '-' && j == i) // leading minus sign
-      {
-        continue;
-      }
-      else if(c == ',' || c == '.')
-      {
-        // no checking as to number of ',' or '.' since in Europe they
-        // use the '.' as a thousands marker, whereas in many other places
-        // they use the ',' as a thousands marker.
-        continue;
-      }
-      else
-      {
-        return false;
-      }
-    }
-    else
+  _mm256_zeroupper();
+  CString::size_type found = findCharSse2(ptr + i, length - i, ch);
+  return (found == CString::NPOS) ? found : i + found;
+}
+
+__attribute__((target("avx2")))
+static CString::size_type rfindCharAvx2(const char *ptr, CString::size_type length, char ch)
+{
+  const __m256i needle = _mm256_set1_epi8(ch);
+  CString::size_type i = length;
+
+  for( ; i >= 32; i -= 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i - 32));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    if(mask != 0)
     {
-      if(trailingSpaces)
-      {
-        return false; // "123 4"
-      }
+      return i - 32 + (31 - __builtin_clz(mask));
     }
   }
 
-  return true;
+  _mm256_zeroupper();
+  return rfindCharSse2(ptr, i, ch);
 }
 
-/** @brief substr
-  *
-  */
-CString CString::substr(size_type index, size_type numChars) const
+// The AVX2 kernels finish their tails with the SSE2 ones, and fall back to
+// scalar code. They call _mm256_zeroupper() first, else the switch from
+// 256 bit to legacy SSE code can stall for longer than a short scan takes.
+static inline bool cpuHasAvx2()
 {
-  // TODO should we do this so that the returned substr references the same
-  //      data to do that, we'd need a way to store an index into the data
+  static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+  return hasAvx2;
+}
 
-  if(index > size())
+#endif // CSTRING_SIMD
+
+static inline CString::size_type findChar(const char *ptr, CString::size_type length, char ch)
+{
+#ifdef CSTRING_SIMD
+  return cpuHasAvx2() ? findCharAvx2(ptr, length, ch) : findCharSse2(ptr, length, ch);
+#else
+  return findCharScalar(ptr, length, ch);
+#endif
+}
+
+static inline CString::size_type rfindChar(const char *ptr, CString::size_type length, char ch)
+{
+#ifdef CSTRING_SIMD
+  return cpuHasAvx2() ? rfindCharAvx2(ptr, length, ch) : rfindCharSse2(ptr, length, ch);
+#else
+  return rfindCharScalar(ptr, length, ch);
+#endif
+}
+
+// Count ch in ptr[0, length)
+static CString::size_type countCharScalar(const char *ptr, CString::size_type length, char ch)
+{
+  CString::size_type total = 0;
+  for(CString::size_type i = 0; i < length; i++)
   {
-    throw CStringOutOfBoundsException("CString::substr index > size");
+    total += (ptr[i] == ch);
   }
 
-  if(numChars == CString::NPOS)
+  return total;
+}
+
+// Write base + the index of each ch in ptr[0, length) to indices, stopping
+// when maxIndices are written. Returns the number written.
+static CString::size_type findAllCharScalar(const char *ptr,
+                                            CString::size_type length,
+                                            char ch,
+                                            CString::size_type base,
+                                            CString::size_type *indices,
+                                            CString::size_type maxIndices)
+{
+  CString::size_type written = 0;
+  for(CString::size_type i = 0; i < length && written < maxIndices; i++)
   {
-    numChars = size() - index;
+    if(ptr[i] == ch)
+    {
+      indices[written++] = base + i;
+    }
   }
 
-  if(index+numChars > size())
+  return written;
+}
+
+#ifdef CSTRING_SIMD
+
+static CString::size_type countCharSse2(const char *ptr, CString::size_type length, char ch)
+{
+  const __m128i needle = _mm_set1_epi8(ch);
+  CString::size_type total = 0;
+  CString::size_type i = 0;
+
+  for( ; i + 16 <= length; i += 16)
   {
-    throw CStringOutOfBoundsException("CString::substr index+numChars > size");
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+    total += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
   }
 
-  CString returnStr(str()+index, numChars, DEFAULT_CAPACITY);
-
-  return returnStr;
+  return total + countCharScalar(ptr + i, length - i, ch);
 }
 
-/** @brief begin
-  *
-  */
-CStringIterator CString::iterator() const
+static CString::size_type findAllCharSse2(const char *ptr,
+                                          CString::size_type length,
+                                          char ch,
+                                          CString::size_type base,
+                                          CString::size_type *indices,
+                                          CString::size_type maxIndices)
 {
-  return CStringIterator(*this);
+  const __m128i needle = _mm_set1_epi8(ch);
+  CString::size_type written = 0;
+  CString::size_type i = 0;
+
+  for( ; i + 16 <= length; i += 16)
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+    while(mask != 0)
+    {
+      if(written == maxIndices)
+      {
+        return written;
+      }
+      indices[written++] = base + i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+
+  return written + findAllCharScalar(ptr + i, length - i, ch, base + i,
+                                     indices + written, maxIndices - written);
 }
 
-/** @brief rbegin
-  *
-  */
-CStringReverseIterator CString::riterator() const
+__attribute__((target("avx2,popcnt")))
+static CString::size_type countCharAvx2(const char *ptr, CString::size_type length, char ch)
 {
-  return CStringReverseIterator(*this);
+  const __m256i needle = _mm256_set1_epi8(ch);
+  CString::size_type total = 0;
+  CString::size_type i = 0;
+
+  for( ; i + 32 <= length; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+    total += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+  }
+
+  _mm256_zeroupper();
+  return total + countCharSse2(ptr + i, length - i, ch);
 }
 
-const char CString::index(size_type indeX) const
+__attribute__((target("avx2")))
+static CString::size_type findAllCharAvx2(const char *ptr,
+                                          CString::size_type length,
+                                          char ch,
+                                          CString::size_type base,
+                                          CString::size_type *indices,
+                                          CString::size_type maxIndices)
 {
-  if(indeX > size())
+  const __m256i needle = _mm256_set1_epi8(ch);
+  CString::size_type written = 0;
+  CString::size_type i = 0;
+
+  for( ; i + 32 <= length; i += 32)
   {
-    throw CStringOutOfBoundsException("CString::index index > size");
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+    while(mask != 0)
+    {
+      if(written == maxIndices)
+      {
+        return written;
+      }
+      indices[written++] = base + i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
   }
 
-  return data_->str_[indeX];
+  _mm256_zeroupper();
+  return written + findAllCharSse2(ptr + i, length - i, ch, base + i,
+                                   indices + written, maxIndices - written);
 }
 
-/** @brief hash
-  *
-  */
-unsigned int CString::hash() const
+#endif // CSTRING_SIMD
+
+static inline CString::size_type countChar(const char *ptr, CString::size_type length, char ch)
 {
-  const char *ptr = str();
-  CString::size_type length = size();
-  unsigned int hash = 0;
+#ifdef CSTRING_SIMD
+  return cpuHasAvx2() ? countCharAvx2(ptr, length, ch) : countCharSse2(ptr, length, ch);
+#else
+  return countCharScalar(ptr, length, ch);
+#endif
+}
 
-  while(length--)
+static inline CString::size_type findAllChar(const char *ptr,
+                                             CString::size_type length,
+                                             char ch,
+                                             CString::size_type base,
+                                             CString::size_type *indices,
+                                             CString::size_type maxIndices)
+{
+#ifdef CSTRING_SIMD
+  return cpuHasAvx2() ?
+      findAllCharAvx2(ptr, length, ch, base, indices, maxIndices) :
+      findAllCharSse2(ptr, length, ch, base, indices, maxIndices);
+#else
+  return findAllCharScalar(ptr, length, ch, base, indices, maxIndices);
+#endif
+}
+
+//----------------------------------------------------------------------
+//
+//    Substring search kernels, for needles of 2 or more chars.
+//      Short needles compare the first and last needle chars at 16 or 32
+//      positions at a time and verify each candidate with memcmp. Long
+//      needles, and repetitive input where candidates keep failing, use
+//      Two-Way (Crochemore-Perrin) with a last char skip table: sublinear
+//      on typical text and linear in the worst case.
+//----------------------------------------------------------------------
+
+// Needles up to this length use the first/last char filter
+static const CString::size_type SHORT_NEEDLE_LENGTH = 32;
+
+// Read chars front to back, or back to front from the end, so
+// the same Two-Way code serves both find and rfind
+struct ForwardChars
+{
+  ForwardChars(const char *ptr, CString::size_type) :
+    ptr_(reinterpret_cast<const unsigned char *>(ptr))
   {
-    hash = (hash << 5) - hash + *ptr;
-    ptr++;
   }
 
-  return hash;
-}
+  unsigned char operator[](CString::size_type i) const
+  {
+    return ptr_[i];
+  }
 
-/** @brief find_
-  *
-  */
-// private
-CString::size_type
-CString::find_(const char *str, CString::size_type index, CString::size_type length) const
+  const unsigned char *ptr_;
+};
+
+struct ReverseChars
 {
-  if(index > size())
+  ReverseChars(const char *ptr, CString::size_type length) :
+    end_(reinterpret_cast<const unsigned char *>(ptr) + length)
   {
-    throw CStringOutOfBoundsException("CString::find index > size");
   }
 
-  if(index+length > size())
+  unsigned char operator[](CString::size_type i) const
   {
-    throw CStringInvalidArgException("CString::find index+length > size");
+    return *(end_ - 1 - i);
   }
 
-  bool foundit = false;
-  int i;
-  int endpoint = size() - length + 1;
-  for(i = index; i < endpoint && foundit == false; i++)
+  const unsigned char *end_;
+};
+
+// The preprocessed needle
+struct TwoWayTable
+{
+  CString::size_type length_;
+  CString::size_type critical_;     // last index of the left half, NPOS if it is empty
+  CString::size_type period_;       // shift after a mismatch in the left half
+  CString::size_type memory_;       // chars known to match after that shift, 0 if not periodic
+  CString::size_type shift_[256];   // last index + 1 of each byte in the needle, 0 if absent
+};
+
+// Compute the maximal suffix of needle and its period, using the
+// reversed byte ordering if reverseOrder is set
+template <class Chars>
+static void maximalSuffix(const Chars &needle,
+                          CString::size_type length,
+                          bool reverseOrder,
+                          CString::size_type &suffix,
+                          CString::size_type &period)
+{
+  CString::size_type ip = CString::NPOS;
+  CString::size_type jp = 0;
+  CString::size_type k = 1;
+  CString::size_type p = 1;
+
+  while(jp + k < length)
   {
-    if(data_->str_[i] == str[0])
+    unsigned char a = needle[ip + k];
+    unsigned char b = needle[jp + k];
+    if(a == b)
     {
-      foundit = true;
-      for(int j = 1; j < length && foundit == true; j++)
+      if(k == p)
       {
-        if(data_->str_[i+j] != str[j])
-        {
-          foundit = false;
-        }
+        jp += p;
+        k = 1;
+      }
+      else
+      {
+        k++;
       }
     }
+    else if(reverseOrder ? (a < b) : (a > b))
+    {
+      jp += k;
+      k = 1;
+      p = jp - ip;
+    }
+    else
+    {
+      ip = jp++;
+      k = p = 1;
+    }
   }
 
-  return foundit ? i-1 : CString::NPOS;
+  suffix = ip;
+  period = p;
 }
 
-
-/** @brief find_
-  *
-  */
-// private
-CString::size_type
-CString::rfind_(const char *str, CString::size_type index, CString::size_type length) const
+template <class Chars>
+static void twoWayPrepare(TwoWayTable &table, const Chars &needle, CString::size_type length)
 {
-  if(index > size())
+  table.length_ = length;
+  memset(table.shift_, 0, sizeof(table.shift_));
+  for(CString::size_type i = 0; i < length; i++)
   {
-    throw CStringOutOfBoundsException("CString::rfind index > size");
+    table.shift_[needle[i]] = i + 1;
   }
 
-  if(index+length > size())
+  // The critical factorization is the later of the two maximal suffixes
+  CString::size_type critical, period, critical2, period2;
+  maximalSuffix(needle, length, false, critical, period);
+  maximalSuffix(needle, length, true, critical2, period2);
+  if(critical2 + 1 > critical + 1)
   {
-    throw CStringInvalidArgException("CString::rfind index+length > size");
+    critical = critical2;
+    period = period2;
   }
 
-  bool foundit = false;
-  int i;
-  int startpoint = size() - index - length + 1;
-  for(i = startpoint; i >= 0 && foundit == false; i--)
+  bool periodic = true;
+  for(CString::size_type i = 0; i < critical + 1; i++)
   {
-    if(data_->str_[i] == str[0])
+    if(needle[i] != needle[i + period])
     {
-      foundit = true;
-      for(int j = 1; j < length && foundit == true; j++)
-      {
-        if(data_->str_[i+j] != str[j])
-        {
-          foundit = false;
-        }
-      }
+      periodic = false;
+      break;
     }
   }
 
-  return foundit ? i+1 : CString::NPOS;
+  table.critical_ = critical;
+  if(periodic)
+  {
+    table.period_ = period;
+    table.memory_ = length - period;
+  }
+  else
+  {
+    table.period_ = ((critical > length - critical - 1) ? critical : length - critical - 1) + 1;
+    table.memory_ = 0;
+  }
 }
 
-/** @brief append_
-  *
-  */
-// private
-CString::size_type CString::append_(const char *strData,
-                                    CString::size_type length,
-                                    CString::size_type minWidth,
-                                    bool leftJustify)
+// Return the first position >= index where the needle matches, or NPOS
+template <class Chars>
+static CString::size_type twoWaySearch(const TwoWayTable &table,
+                                       const Chars &needle,
+                                       const Chars &haystack,
+                                       CString::size_type hayLength,
+                                       CString::size_type index)
 {
-  size_type totalLength = (length < minWidth) ? minWidth : length;
-
-  if(checkCapacity(totalLength))
+  const CString::size_type length = table.length_;
+  const CString::size_type critical = table.critical_;
+  if(hayLength < length)
   {
-    incrementCapacity(totalLength);
+    return CString::NPOS;
   }
 
-  size_type appendIndex = size();
+  const CString::size_type lastPos = hayLength - length;
+  CString::size_type memory = 0;
+  CString::size_type pos = index;
 
-  // pad spaces
-  if( length < minWidth)
+  while(pos <= lastPos)
   {
-    size_type padStart;
-    size_type padLength;
-    if(leftJustify)
+    // Skip on the last char, every skip is at least as safe as a Two-Way
+    // shift so only the memory of a periodic needle is lost
+    CString::size_type k = length - table.shift_[haystack[pos + length - 1]];
+    if(k != 0)
     {
-      padStart = size();
-      padLength = size() + (minWidth - length);
-      appendIndex = padLength;
+      pos += k;
+      memory = 0;
+      continue;
     }
-    else
+
+    // Right half, left to right
+    k = (critical + 1 > memory) ? critical + 1 : memory;
+    while(k < length && needle[k] == haystack[pos + k])
     {
-      padStart = size() + length;
-      padLength = size() + minWidth;
+      k++;
     }
 
-    memset(data_->str_ + padStart, padChar_, padLength);
-  }
+    if(k < length)
+    {
+      pos += k - critical;
+      memory = 0;
+      continue;
+    }
 
-  memcpy(data_->str_ + appendIndex, strData, length);
-  data_->size_ += totalLength;
-  data_->str_[size()] = '\0';
+    // Left half, right to left
+    k = critical + 1;
+    while(k > memory && needle[k - 1] == haystack[pos + k - 1])
+    {
+      k--;
+    }
 
-  return totalLength;
+    if(k <= memory)
+    {
+      return pos;
+    }
+
+    pos += table.period_;
+    memory = table.memory_;
+  }
+
+  return CString::NPOS;
 }
 
-/** @brief insert
-  *
-  */
-CString::size_type
-CString::insert(const char ch,
-                CString::size_type index,
-                CString::size_type minWidth,
-                bool leftJustify,
-                CString::size_type count)
+static void twoWayPrepareFind(TwoWayTable &table, const char *needle, CString::size_type needleLength)
 {
-  char temp[count];
-  memset(temp, ch, count);
-
-  return insert_(temp, index, count, minWidth, leftJustify);
+  twoWayPrepare(table, ForwardChars(needle, needleLength), needleLength);
 }
 
-CString::size_type
-CString::insert(int num,
-                CString::size_type index,
-                CString::size_type minWidth,
-                bool leftJustify,
-                CString::size_type count)
+static void twoWayPrepareRfind(TwoWayTable &table, const char *needle, CString::size_type needleLength)
 {
-  char temp[10*count]; // a max int wont be more than 10 digits
-  int numDigits = 0;
+  twoWayPrepare(table, ReverseChars(needle, needleLength), needleLength);
+}
 
-  for(int i = 0; i < count; i++)
+// The table is prepared here if its NULL, CStringSearcher passes its own
+static CString::size_type twoWayFind(const char *haystack,
+                                     CString::size_type hayLength,
+                                     const char *needle,
+                                     CString::size_type needleLength,
+                                     CString::size_type index,
+                                     const TwoWayTable *table)
+{
+  TwoWayTable localTable;
+  if(table == NULL)
   {
-    numDigits += sprintf(temp + numDigits, "%d", num);
+    twoWayPrepareFind(localTable, needle, needleLength);
+    table = &localTable;
   }
 
-  return insert_(temp, index, numDigits, minWidth, leftJustify);
+  return twoWaySearch(*table,
+                      ForwardChars(needle, needleLength),
+                      ForwardChars(haystack, hayLength),
+                      hayLength,
+                      index);
 }
 
-CString::size_type
-CString::insert(long num,
-                CString::size_type index,
-                CString::size_type minWidth,
-                bool leftJustify,
-                CString::size_type count)
+// Return the last needle found entirely within haystack[0, hayLength), or NPOS
+static CString::size_type twoWayRfind(const char *haystack,
+                                      CString::size_type hayLength,
+                                      const char *needle,
+                                      CString::size_type needleLength,
+                                      const TwoWayTable *table)
 {
-  char temp[20*count]; // a max long wont be more than 20 digits
-  int numDigits = 0;
-
-  for(int i = 0; i < count; i++)
+  TwoWayTable localTable;
+  if(table == NULL)
   {
-    numDigits += sprintf(temp + numDigits, "%ld", num);
+    twoWayPrepareRfind(localTable, needle, needleLength);
+    table = &localTable;
   }
 
-  return insert_(temp, index, numDigits, minWidth, leftJustify);
+  CString::size_type found = twoWaySearch(*table,
+                                          ReverseChars(needle, needleLength),
+                                          ReverseChars(haystack, hayLength),
+                                          hayLength,
+                                          0);
+  return (found == CString::NPOS) ? found : hayLength - needleLength - found;
 }
 
-CString::size_type
-CString::insert(float num,
-                CString::size_type index,
-                CString::size_type numDecimals,
-                CString::size_type minWidth,
-                bool leftJustify,
-                CString::size_type count)
+#ifdef CSTRING_SIMD
+
+// The filter gives up once verifying candidates costs more than this,
+// relative to the chars scanned so far: the input is repetitive
+static inline bool filterTooCostly(CString::size_type verified, CString::size_type scanned)
 {
-  char temp[20*count]; // a max float wont be more than 30 digits
-  int numDigits = 0;
+  return verified > 2 * scanned + 1024;
+}
 
-  for(int i = 0; i < count; i++)
+// Check the candidates left after a vector loop, from index forwards
+static CString::size_type filterFindTail(const char *haystack,
+                                         CString::size_type hayLength,
+                                         const char *needle,
+                                         CString::size_type needleLength,
+                                         CString::size_type index)
+{
+  for(CString::size_type i = index; i + needleLength <= hayLength; i++)
   {
-    numDigits += sprintf(temp + numDigits, "%.*f", numDecimals, num);
+    if(haystack[i] == needle[0] &&
+       memcmp(haystack+i+1, needle+1, needleLength-1) == 0)
+    {
+      return i;
+    }
   }
 
-  return insert_(temp, index, numDigits, minWidth, leftJustify);
+  return CString::NPOS;
 }
 
-CString::size_type
-CString::insert(bool b,
-                size_type index,
-                bool displayText,
-                CString::size_type minWidth,
-                bool leftJustify,
-                size_type count)
+// Check the candidates [0, end) left after a vector loop, backwards
+static CString::size_type filterRfindTail(const char *haystack,
+                                          CString::size_type end,
+                                          const char *needle,
+                                          CString::size_type needleLength)
 {
-  char temp[5*count]; // max str size will be "false"
-  int numDigits = 0;
-
-  for(int i = 0; i < count; i++)
+  for(CString::size_type i = end; i-- > 0; )
   {
-    if(displayText)
+    if(haystack[i] == needle[0] &&
+       memcmp(haystack+i+1, needle+1, needleLength-1) == 0)
     {
-      numDigits += sprintf(temp + numDigits, (b ? "true" : "false"));
-    }
-    else
-    {
-      temp[numDigits++] = (b ? '1' : '0');
+      return i;
     }
   }
 
-  return insert_(temp, index, numDigits, minWidth, leftJustify);
+  return CString::NPOS;
 }
 
-// TODO allow to specify format string
-CString::size_type
-CString::insertHex(int num,
-                   CString::size_type index,
-                   CString::size_type minWidth,
-                   bool leftJustify,
-                   CString::size_type count)
+static CString::size_type filterFindSse2(const char *haystack,
+                                         CString::size_type hayLength,
+                                         const char *needle,
+                                         CString::size_type needleLength,
+                                         CString::size_type index,
+                                         const TwoWayTable *table)
 {
-  // a max int wont be more than 10 digits, and 2 hex digits per int digit plus 2 leading chars 0x
-  char temp[22*count];
-  int numDigits = 0;
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+  const CString::size_type lastOffset = needleLength - 1;
+  CString::size_type verified = 0;
+  CString::size_type i = index;
 
-  for(int i = 0; i < count; i++)
+  for( ; i + lastOffset + 16 <= hayLength; i += 16)
   {
-    numDigits += sprintf(temp + numDigits, "%X", num);
+    __m128i firstChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+    __m128i lastChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i + lastOffset));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstChunk, first),
+                                                        _mm_cmpeq_epi8(lastChunk, last)));
+    while(mask != 0)
+    {
+      CString::size_type pos = i + __builtin_ctz(mask);
+      if(memcmp(haystack+pos+1, needle+1, needleLength-2) == 0)
+      {
+        return pos;
+      }
+      verified += needleLength;
+      mask &= mask - 1;
+    }
+
+    if(filterTooCostly(verified, i - index))
+    {
+      return twoWayFind(haystack, hayLength, needle, needleLength, i + 16, table);
+    }
   }
 
-  return insert_(temp, index, numDigits, minWidth, leftJustify);
+  return filterFindTail(haystack, hayLength, needle, needleLength, i);
 }
 
-/** @brief insert_
-  *
-  */
-// private
-CString::size_type
-CString::insert_(const char *strData,
-                 CString::size_type index,
-                 CString::size_type length,
-                 CString::size_type minWidth,
-                 bool leftJustify)
+static CString::size_type filterRfindSse2(const char *haystack,
+                                          CString::size_type hayLength,
+                                          const char *needle,
+                                          CString::size_type needleLength,
+                                          const TwoWayTable *table)
 {
-  if(index == CString::NPOS)
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+  const CString::size_type lastOffset = needleLength - 1;
+  CString::size_type verified = 0;
+  CString::size_type end = hayLength - lastOffset;
+
+  for( ; end >= 16; end -= 16)
   {
-    index = size();
+    CString::size_type base = end - 16;
+    __m128i firstChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + base));
+    __m128i lastChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + base + lastOffset));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstChunk, first),
+                                                        _mm_cmpeq_epi8(lastChunk, last)));
+    while(mask != 0)
+    {
+      unsigned int bit = 31 - __builtin_clz(mask);
+      if(memcmp(haystack+base+bit+1, needle+1, needleLength-2) == 0)
+      {
+        return base + bit;
+      }
+      verified += needleLength;
+      mask &= ~(1u << bit);
+    }
+
+    if(filterTooCostly(verified, hayLength - lastOffset - base))
+    {
+      return twoWayRfind(haystack, base + lastOffset, needle, needleLength, table);
+    }
   }
 
-  if(index > size())
+  return filterRfindTail(haystack, end, needle, needleLength);
+}
+
+__attribute__((target("avx2")))
+static CString::size_type filterFindAvx2(const char *haystack,
+                                         CString::size_type hayLength,
+                                         const char *needle,
+                                         CString::size_type needleLength,
+                                         CString::size_type index,
+                                         const TwoWayTable *table)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+  const CString::size_type lastOffset = needleLength - 1;
+  CString::size_type verified = 0;
+  CString::size_type i = index;
+
+  for( ; i + lastOffset + 32 <= hayLength; i += 32)
   {
-    throw CStringOutOfBoundsException("CString::insert index > size");
+    __m256i firstChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i));
+    __m256i lastChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i + lastOffset));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(firstChunk, first),
+                                                              _mm256_cmpeq_epi8(lastChunk, last)));
+    while(mask != 0)
+    {
+      CString::size_type pos = i + __builtin_ctz(mask);
+      if(memcmp(haystack+pos+1, needle+1, needleLength-2) == 0)
+      {
+        return pos;
+      }
+      verified += needleLength;
+      mask &= mask - 1;
+    }
+
+    if(filterTooCostly(verified, i - index))
+    {
+      _mm256_zeroupper();
+      return twoWayFind(haystack, hayLength, needle, needleLength, i + 32, table);
+    }
   }
 
-  size_type totalLength = (length < minWidth) ? minWidth : length;
+  _mm256_zeroupper();
+  return filterFindSse2(haystack, hayLength, needle, needleLength, i, table);
+}
 
-  if(checkCapacity(totalLength))
+__attribute__((target("avx2")))
+static CString::size_type filterRfindAvx2(const char *haystack,
+                                          CString::size_type hayLength,
+                                          const char *needle,
+                                          CString::size_type needleLength,
+                                          const TwoWayTable *table)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+  const CString::size_type lastOffset = needleLength - 1;
+  CString::size_type verified = 0;
+  CString::size_type end = hayLength - lastOffset;
+
+  for( ; end >= 32; end -= 32)
   {
-    incrementCapacity(totalLength);
+    CString::size_type base = end - 32;
+    __m256i firstChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + base));
+    __m256i lastChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + base + lastOffset));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(firstChunk, first),
+                                                              _mm256_cmpeq_epi8(lastChunk, last)));
+    while(mask != 0)
+    {
+      unsigned int bit = 31 - __builtin_clz(mask);
+      if(memcmp(haystack+base+bit+1, needle+1, needleLength-2) == 0)
+      {
+        return base + bit;
+      }
+      verified += needleLength;
+      mask &= ~(1u << bit);
+    }
+
+    if(filterTooCostly(verified, hayLength - lastOffset - base))
+    {
+      _mm256_zeroupper();
+      return twoWayRfind(haystack, base + lastOffset, needle, needleLength, table);
+    }
   }
 
-  //
-  // If inserting in the middle of the string, copy from index to
-  // end of str to a temp holding area, then insert the new string,
-  // then copy from the temp str to the end of the string.
-  //
+  _mm256_zeroupper();
+  return filterRfindSse2(haystack, end + lastOffset, needle, needleLength, table);
+}
 
-  size_type substrLen = size()-index;
-  char temp[substrLen];
-  // If index = size(), then its an append and this temp copy isnt necessary
-  if(substrLen > 0)
+// Scan from index writing each non overlapping needle to indices, until
+// maxIndices are written or the vector loop ends. Returns the number
+// written, with index set to where findChars should continue. gaveUp is set
+// if verifying candidates cost too much, Two-Way should do the rest.
+static CString::size_type filterFindAllSse2(const char *haystack,
+                                            CString::size_type hayLength,
+                                            const char *needle,
+                                            CString::size_type needleLength,
+                                            CString::size_type &index,
+                                            CString::size_type *indices,
+                                            CString::size_type maxIndices,
+                                            bool &gaveUp)
+{
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needleLength - 1]);
+  const CString::size_type lastOffset = needleLength - 1;
+  const CString::size_type start = index;
+  CString::size_type verified = 0;
+  CString::size_type written = 0;
+  CString::size_type next = index;  // the first start that doesnt overlap
+  CString::size_type i = index;
+
+  for( ; i + lastOffset + 16 <= hayLength; i += 16)
   {
-    memcpy(temp, str()+index, substrLen);
+    __m128i firstChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i));
+    __m128i lastChunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i + lastOffset));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstChunk, first),
+                                                        _mm_cmpeq_epi8(lastChunk, last)));
+    if(next > i)
+    {
+      mask = (next - i >= 16) ? 0 : mask & (~0u << (next - i));
+    }
+
+    while(mask != 0)
+    {
+      CString::size_type pos = i + __builtin_ctz(mask);
+      if(memcmp(haystack+pos+1, needle+1, needleLength-2) != 0)
+      {
+        verified += needleLength;
+        mask &= mask - 1;
+        continue;
+      }
+
+      if(written == maxIndices)
+      {
+        index = pos;
+        return written;
+      }
+      indices[written++] = pos;
+      next = pos + needleLength;
+      mask = (next - i >= 16) ? 0 : mask & (~0u << (next - i));
+    }
+
+    if(filterTooCostly(verified, i - start))
+    {
+      gaveUp = true;
+      i += 16;
+      break;
+    }
   }
 
-  size_type insertIndex = index;
+  index = (next > i) ? next : i;
+  return written;
+}
 
-  // pad spaces
-  if( length < minWidth)
+__attribute__((target("avx2")))
+static CString::size_type filterFindAllAvx2(const char *haystack,
+                                            CString::size_type hayLength,
+                                            const char *needle,
+                                            CString::size_type needleLength,
+                                            CString::size_type &index,
+                                            CString::size_type *indices,
+                                            CString::size_type maxIndices,
+                                            bool &gaveUp)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+  const CString::size_type lastOffset = needleLength - 1;
+  const CString::size_type start = index;
+  CString::size_type verified = 0;
+  CString::size_type written = 0;
+  CString::size_type next = index;  // the first start that doesnt overlap
+  CString::size_type i = index;
+
+  for( ; i + lastOffset + 32 <= hayLength; i += 32)
   {
-    size_type padStart;
-    size_type padLength;
-    if(leftJustify)
+    __m256i firstChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i));
+    __m256i lastChunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i + lastOffset));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(firstChunk, first),
+                                                              _mm256_cmpeq_epi8(lastChunk, last)));
+    if(next > i)
     {
-      padStart = index;
-      padLength = index + (minWidth - length);
-      insertIndex = padLength;
+      mask = (next - i >= 32) ? 0 : mask & (~0u << (next - i));
     }
-    else
+
+    while(mask != 0)
     {
-      padStart = index + length;
-      padLength = index + minWidth;
+      CString::size_type pos = i + __builtin_ctz(mask);
+      if(memcmp(haystack+pos+1, needle+1, needleLength-2) != 0)
+      {
+        verified += needleLength;
+        mask &= mask - 1;
+        continue;
+      }
+
+      if(written == maxIndices)
+      {
+        index = pos;
+        return written;
+      }
+      indices[written++] = pos;
+      next = pos + needleLength;
+      mask = (next - i >= 32) ? 0 : mask & (~0u << (next - i));
     }
 
-    memset(data_->str_ + padStart, padChar_, padLength);
+    if(filterTooCostly(verified, i - start))
+    {
+      gaveUp = true;
+      i += 32;
+      break;
+    }
   }
 
-  // Insert the string
-  memcpy(data_->str_+insertIndex, strData, length);
-  data_->size_ += totalLength;
+  index = (next > i) ? next : i;
+  return written;
+}
 
-  // Again, if index = size(), then its an append and this final copy isnt necessary
-  if(substrLen > 0)
+#endif // CSTRING_SIMD
+
+//----------------------------------------------------------------------
+//
+//    ASCII case folding kernels.
+//      Chars are folded to lower case as they are read, so case
+//      insensitive searches and compares dont modify or copy anything.
+//      Only 'A'-'Z' are folded, other bytes compare as they are.
+//----------------------------------------------------------------------
+
+static inline unsigned char asciiLower(unsigned char ch)
+{
+  return (static_cast<unsigned char>(ch - 'A') < 26) ? (ch | 0x20) : ch;
+}
+
+// Reads chars folded to lower case, for the Two-Way code
+struct FoldedChars
+{
+  FoldedChars(const char *ptr, CString::size_type) :
+    ptr_(reinterpret_cast<const unsigned char *>(ptr))
   {
-    memcpy(data_->str_+index+totalLength, temp, substrLen);
   }
 
-  // Always terminate the string
-  data_->str_[size()] = '\0';
+  unsigned char operator[](CString::size_type i) const
+  {
+    return asciiLower(ptr_[i]);
+  }
 
-  return totalLength;
+  const unsigned char *ptr_;
+};
+
+// Return the first index where ptr1 and ptr2 differ ignoring case, or length
+static CString::size_type mismatchFoldedScalar(const char *ptr1, const char *ptr2, CString::size_type length)
+{
+  const unsigned char *str1 = reinterpret_cast<const unsigned char *>(ptr1);
+  const unsigned char *str2 = reinterpret_cast<const unsigned char *>(ptr2);
+  for(CString::size_type i = 0; i < length; i++)
+  {
+    if(str1[i] != str2[i] && asciiLower(str1[i]) != asciiLower(str2[i]))
+    {
+      return i;
+    }
+  }
+
+  return length;
 }
 
-/** @brief remove
-  *
-  */
-CString::size_type
-CString::remove(CString::size_type index, CString::size_type numChars)
+#ifdef CSTRING_SIMD
+
+// Return 0x20 in the lanes of chunk holding a letter from first to first + 25:
+// shifting first to -128 puts those letters, and only them, below -128 + 26
+// in a signed compare
+static inline __m128i caseBitSse2(__m128i chunk, char first)
 {
-  if(index > size())
+  __m128i shifted = _mm_add_epi8(chunk, _mm_set1_epi8((char) (0x80 - first)));
+  __m128i isLetter = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char) (0x80 + 26)));
+  return _mm_and_si128(isLetter, _mm_set1_epi8(0x20));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i caseBitAvx2(__m256i chunk, char first)
+{
+  __m256i shifted = _mm256_add_epi8(chunk, _mm256_set1_epi8((char) (0x80 - first)));
+  __m256i isLetter = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (0x80 + 26)), shifted);
+  return _mm256_and_si256(isLetter, _mm256_set1_epi8(0x20));
+}
+
+// Fold the upper case letters in chunk to lower case
+static inline __m128i foldSse2(__m128i chunk)
+{
+  return _mm_or_si128(chunk, caseBitSse2(chunk, 'A'));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i foldAvx2(__m256i chunk)
+{
+  return _mm256_or_si256(chunk, caseBitAvx2(chunk, 'A'));
+}
+
+static CString::size_type mismatchFoldedSse2(const char *ptr1, const char *ptr2, CString::size_type length)
+{
+  CString::size_type i = 0;
+  for( ; i + 16 <= length; i += 16)
   {
-    throw CStringOutOfBoundsException("CString::remove index > size");
+    __m128i chunk1 = foldSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr1 + i)));
+    __m128i chunk2 = foldSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr2 + i)));
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk1, chunk2)) ^ 0xffff;
+    if(mask != 0)
+    {
+      return i + __builtin_ctz(mask);
+    }
   }
 
-  // Remove to end of string
-  if(numChars == CString::NPOS)
+  return i + mismatchFoldedScalar(ptr1 + i, ptr2 + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static CString::size_type mismatchFoldedAvx2(const char *ptr1, const char *ptr2, CString::size_type length)
+{
+  CString::size_type i = 0;
+  for( ; i + 32 <= length; i += 32)
   {
-    numChars = size() - index;
+    __m256i chunk1 = foldAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr1 + i)));
+    __m256i chunk2 = foldAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr2 + i)));
+    unsigned int mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk1, chunk2));
+    if(mask != 0)
+    {
+      return i + __builtin_ctz(mask);
+    }
   }
 
-  if(numChars+index > size())
+  _mm256_zeroupper();
+  return i + mismatchFoldedSse2(ptr1 + i, ptr2 + i, length - i);
+}
+
+#endif // CSTRING_SIMD
+
+static inline CString::size_type mismatchFolded(const char *ptr1, const char *ptr2, CString::size_type length)
+{
+#ifdef CSTRING_SIMD
+  return cpuHasAvx2() ? mismatchFoldedAvx2(ptr1, ptr2, length) : mismatchFoldedSse2(ptr1, ptr2, length);
+#else
+  return mismatchFoldedScalar(ptr1, ptr2, length);
+#endif
+}
+
+// Copy length chars from src to dst, flipping the case of the letters from
+// first to first + 25: 'a' converts to upper case, 'A' to lower case.
+// src and dst may be the same buffer.
+static void convertCaseScalar(const char *src, char *dst, CString::size_type length, char first)
+{
+  for(CString::size_type i = 0; i < length; i++)
   {
-    throw CStringInvalidArgException("CString::remove numChars+index > size");
+    unsigned char ch = static_cast<unsigned char>(src[i]);
+    dst[i] = (static_cast<unsigned char>(ch - first) < 26) ? (ch ^ 0x20) : ch;
   }
+}
 
-  // If we're removing until end of string, we dont need the memcpy
-  if(numChars+index != size())
+#ifdef CSTRING_SIMD
+
+static void convertCaseSse2(const char *src, char *dst, CString::size_type length, char first)
+{
+  CString::size_type i = 0;
+  for( ; i + 16 <= length; i += 16)
   {
-    memcpy(data_->str_+index, str()+index+numChars, size()-index-numChars);
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(chunk, caseBitSse2(chunk, first)));
   }
 
-  data_->size_ -= numChars;
-  data_->str_[size()] = '\0';
+  convertCaseScalar(src + i, dst + i, length - i, first);
+}
 
-  return numChars;
+__attribute__((target("avx2")))
+static void convertCaseAvx2(const char *src, char *dst, CString::size_type length, char first)
+{
+  CString::size_type i = 0;
+  for( ; i + 32 <= length; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_xor_si256(chunk, caseBitAvx2(chunk, first)));
+  }
+
+  _mm256_zeroupper();
+  convertCaseSse2(src + i, dst + i, length - i, first);
 }
 
-/** @brief replace
-  *
-  */
-CString::size_type
-CString::replace(const char ch, CString::size_type index, CString::size_type count, CString::size_type length)
+#endif // CSTRING_SIMD
+
+static inline void convertCase(const char *src, char *dst, CString::size_type length, char first)
 {
-  char temp[count];
-  for(int i = 0; i < count; i++)
+#ifdef CSTRING_SIMD
+  if(cpuHasAvx2())
+  {
+    convertCaseAvx2(src, dst, length, first);
+  }
+  else
   {
-    temp[i++] = ch;
+    convertCaseSse2(src, dst, length, first);
   }
+#else
+  convertCaseScalar(src, dst, length, first);
+#endif
+}
+
+// Find needle in haystack from index ignoring case, with Two-Way over the
+// folded chars, or NPOS
+static CString::size_type twoWayFindFolded(const char *haystack,
+                                           CString::size_type hayLength,
+                                           const char *needle,
+                                           CString::size_type needleLength,
+                                           CString::size_type index)
+{
+  TwoWayTable table;
+  FoldedChars needleChars(needle, needleLength);
+  twoWayPrepare(table, needleChars, needleLength);
 
-  return replace_(temp, index, length);
+  return twoWaySearch(table, needleChars, FoldedChars(haystack, hayLength), hayLength, index);
 }
 
-/** @brief replace
-  *
-  */
-// private
-CString::size_type
-CString::replace_(const char *strData, CString::size_type index, CString::size_type length)
+#ifdef CSTRING_SIMD
+
+// The first/last char filter of filterFindSse2(), comparing folded chunks
+// against the folded needle chars
+static CString::size_type filterFindFoldedSse2(const char *haystack,
+                                               CString::size_type hayLength,
+                                               const char *needle,
+                                               CString::size_type needleLength,
+                                               CString::size_type index)
 {
-  if(index > size())
+  const __m128i first = _mm_set1_epi8(asciiLower(needle[0]));
+  const __m128i last = _mm_set1_epi8(asciiLower(needle[needleLength - 1]));
+  const CString::size_type lastOffset = needleLength - 1;
+  CString::size_type verified = 0;
+  CString::size_type i = index;
+
+  for( ; i + lastOffset + 16 <= hayLength; i += 16)
   {
-    throw CStringOutOfBoundsException("CString::replace index > size");
+    __m128i firstChunk = foldSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i)));
+    __m128i lastChunk = foldSse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(haystack + i + lastOffset)));
+    unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(firstChunk, first),
+                                                        _mm_cmpeq_epi8(lastChunk, last)));
+    while(mask != 0)
+    {
+      CString::size_type pos = i + __builtin_ctz(mask);
+      if(mismatchFolded(haystack+pos+1, needle+1, needleLength-2) == needleLength-2)
+      {
+        return pos;
+      }
+      verified += needleLength;
+      mask &= mask - 1;
+    }
+
+    if(filterTooCostly(verified, i - index))
+    {
+      return twoWayFindFolded(haystack, hayLength, needle, needleLength, i + 16);
+    }
   }
 
-  if(length == CString::NPOS)
+  for( ; i + needleLength <= hayLength; i++)
   {
-    length = size();
+    if(mismatchFolded(haystack+i, needle, needleLength) == needleLength)
+    {
+      return i;
+    }
   }
 
-  int strDataLength = strlen(strData);
-  if(length == 0)
+  return CString::NPOS;
+}
+
+__attribute__((target("avx2")))
+static CString::size_type filterFindFoldedAvx2(const char *haystack,
+                                               CString::size_type hayLength,
+                                               const char *needle,
+                                               CString::size_type needleLength,
+                                               CString::size_type index)
+{
+  const __m256i first = _mm256_set1_epi8(asciiLower(needle[0]));
+  const __m256i last = _mm256_set1_epi8(asciiLower(needle[needleLength - 1]));
+  const CString::size_type lastOffset = needleLength - 1;
+  CString::size_type verified = 0;
+  CString::size_type i = index;
+
+  for( ; i + lastOffset + 32 <= hayLength; i += 32)
   {
-    length = strDataLength;
+    __m256i firstChunk = foldAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i)));
+    __m256i lastChunk = foldAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(haystack + i + lastOffset)));
+    unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(firstChunk, first),
+                                                              _mm256_cmpeq_epi8(lastChunk, last)));
+    while(mask != 0)
+    {
+      CString::size_type pos = i + __builtin_ctz(mask);
+      if(mismatchFoldedAvx2(haystack+pos+1, needle+1, needleLength-2) == needleLength-2)
+      {
+        return pos;
+      }
+      verified += needleLength;
+      mask &= mask - 1;
+    }
+
+    if(filterTooCostly(verified, i - index))
+    {
+      _mm256_zeroupper();
+      return twoWayFindFolded(haystack, hayLength, needle, needleLength, i + 32);
+    }
   }
 
-  // Replacing off end of string
-  if((length+index) > size())
+  _mm256_zeroupper();
+  return filterFindFoldedSse2(haystack, hayLength, needle, needleLength, i);
+}
+
+#endif // CSTRING_SIMD
+
+//----------------------------------------------------------------------
+//
+//    Delimiter kernels, for the tokenizer.
+//      Each returns the index of the first char in ptr[0, length) that is
+//      a delimiter, or with isDelimiter false the first one that isnt,
+//      or length. table has a non 0 entry for each delimiter char. Sets
+//      of up to SIMD_DELIMITERS chars are compared 16 or 32 at a time,
+//      larger ones are looked up in the table a char at a time.
+//----------------------------------------------------------------------
+
+static const CString::size_type SIMD_DELIMITERS = 4;
+
+static CString::size_type findDelimiterScalar(const char *ptr,
+                                              CString::size_type length,
+                                              const unsigned char *table,
+                                              bool isDelimiter)
+{
+  const unsigned char *str = reinterpret_cast<const unsigned char *>(ptr);
+  for(CString::size_type i = 0; i < length; i++)
   {
-    if(checkCapacity((length+index) - size()))
+    if((table[str[i]] != 0) == isDelimiter)
     {
-      incrementCapacity((length+index) - size());
+      return i;
     }
   }
 
-  // if(length > strDataLength)
-  //     str="abcdefgh", replace("xyz", 2, 4) => str="abxyzgh", size reduced
-  // if(length < strDataLength)
-  //     str="abcdefgh", replace("xyz", 2, 2) => str="abxyzefgh", size increased
+  return length;
+}
+
+#ifdef CSTRING_SIMD
 
-  int tempSize = size() - (length + index);
-  if(tempSize > 0)
+static CString::size_type findDelimiterSse2(const char *ptr,
+                                            CString::size_type length,
+                                            const unsigned char *table,
+                                            const char *delimiters,
+                                            CString::size_type numDelimiters,
+                                            bool isDelimiter)
+{
+  __m128i sets[SIMD_DELIMITERS];
+  for(CString::size_type d = 0; d < numDelimiters; d++)
   {
-    char temp[tempSize];
-    memcpy(temp, data_->str_+index+length, tempSize);
-    memcpy(data_->str_+index, strData, strDataLength);
-    memcpy(data_->str_+index+strDataLength, temp, tempSize);
-    data_->size_ += (strDataLength-length);
+    sets[d] = _mm_set1_epi8(delimiters[d]);
   }
-  else
+  unsigned int flip = isDelimiter ? 0 : 0xffff;
+
+  CString::size_type i = 0;
+  for( ; i + 16 <= length; i += 16)
   {
-    // This is either the case of replacing off the end of the string
-    // or the str to replace is the same length as strData
-    memcpy(data_->str_+index, strData, strDataLength);
-    data_->size_ = index + strDataLength;
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+    __m128i matches = _mm_cmpeq_epi8(chunk, sets[0]);
+    for(CString::size_type d = 1; d < numDelimiters; d++)
+    {
+      matches = _mm_or_si128(matches, _mm_cmpeq_epi8(chunk, sets[d]));
+    }
+    unsigned int mask = _mm_movemask_epi8(matches) ^ flip;
+    if(mask != 0)
+    {
+      return i + __builtin_ctz(mask);
+    }
   }
 
-  data_->str_[size()] = '\0';
+  return i + findDelimiterScalar(ptr + i, length - i, table, isDelimiter);
+}
 
-  return length;
+__attribute__((target("avx2")))
+static CString::size_type findDelimiterAvx2(const char *ptr,
+                                            CString::size_type length,
+                                            const unsigned char *table,
+                                            const char *delimiters,
+                                            CString::size_type numDelimiters,
+                                            bool isDelimiter)
+{
+  __m256i sets[SIMD_DELIMITERS];
+  for(CString::size_type d = 0; d < numDelimiters; d++)
+  {
+    sets[d] = _mm256_set1_epi8(delimiters[d]);
+  }
+  unsigned int flip = isDelimiter ? 0 : 0xffffffff;
+
+  CString::size_type i = 0;
+  for( ; i + 32 <= length; i += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(ptr + i));
+    __m256i matches = _mm256_cmpeq_epi8(chunk, sets[0]);
+    for(CString::size_type d = 1; d < numDelimiters; d++)
+    {
+      matches = _mm256_or_si256(matches, _mm256_cmpeq_epi8(chunk, sets[d]));
+    }
+    unsigned int mask = _mm256_movemask_epi8(matches) ^ flip;
+    if(mask != 0)
+    {
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  _mm256_zeroupper();
+  return i + findDelimiterSse2(ptr + i, length - i, table, delimiters, numDelimiters, isDelimiter);
+}
+
+#endif // CSTRING_SIMD
+
+static inline CString::size_type findDelimiter(const char *ptr,
+                                               CString::size_type length,
+                                               const unsigned char *table,
+                                               const char *delimiters,
+                                               CString::size_type numDelimiters,
+                                               bool isDelimiter)
+{
+#ifdef CSTRING_SIMD
+  if(length > 16 && numDelimiters > 0 && numDelimiters <= SIMD_DELIMITERS)
+  {
+    // Most tokens and runs of delimiters are short, so look up
+    // the first chars before setting up the vector compares
+    CString::size_type found = findDelimiterScalar(ptr, 16, table, isDelimiter);
+    if(found < 16)
+    {
+      return found;
+    }
+
+    return 16 + (cpuHasAvx2() ? findDelimiterAvx2(ptr + 16, length - 16, table, delimiters, numDelimiters, isDelimiter)
+                              : findDelimiterSse2(ptr + 16, length - 16, table, delimiters, numDelimiters, isDelimiter));
+  }
+#endif
+
+  return findDelimiterScalar(ptr, length, table, isDelimiter);
+}
+
+//----------------------------------------------------------------------
+//
+//    Search and hash helpers, shared by CString and CStringView.
+//      The callers check the index and lengths.
+//----------------------------------------------------------------------
+
+static unsigned int multiplyHash(const char *ptr, CString::size_type length)
+{
+  unsigned int hash = 0;
+
+  while(length--)
+  {
+    hash = (hash << 5) - hash + *ptr;
+    ptr++;
+  }
+
+  return hash;
+}
+
+// wyhash (final version 4, public domain) by Wang Yi, with the default secret.
+// The words are read little endian, and the 64 bit result is folded to 32.
+static inline void wyMultiply(unsigned long long &a, unsigned long long &b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t product = static_cast<__uint128_t>(a) * b;
+  a = static_cast<unsigned long long>(product);
+  b = static_cast<unsigned long long>(product >> 64);
+#else
+  unsigned long long aHigh = a >> 32, aLow = static_cast<unsigned int>(a);
+  unsigned long long bHigh = b >> 32, bLow = static_cast<unsigned int>(b);
+  unsigned long long high = aHigh * bHigh, middle0 = aHigh * bLow, middle1 = aLow * bHigh, low = aLow * bLow;
+  unsigned long long carry = (low >> 32) + static_cast<unsigned int>(middle0) + static_cast<unsigned int>(middle1);
+  a = low + (middle0 << 32) + (middle1 << 32);
+  b = high + (middle0 >> 32) + (middle1 >> 32) + (carry >> 32);
+#endif
+}
+
+static inline unsigned long long wyMix(unsigned long long a, unsigned long long b)
+{
+  wyMultiply(a, b);
+  return a ^ b;
+}
+
+static inline unsigned long long wyRead8(const unsigned char *ptr)
+{
+  unsigned long long value;
+  memcpy(&value, ptr, 8);
+  return value;
+}
+
+static inline unsigned long long wyRead4(const unsigned char *ptr)
+{
+  unsigned int value;
+  memcpy(&value, ptr, 4);
+  return value;
+}
+
+static unsigned int wyHash(const char *str, CString::size_type length)
+{
+  static const unsigned long long secret[4] =
+    { 0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull };
+
+  const unsigned char *ptr = reinterpret_cast<const unsigned char *>(str);
+  unsigned long long seed = wyMix(secret[0], secret[1]);
+  unsigned long long a;
+  unsigned long long b;
+
+  if(length <= 16)
+  {
+    if(length >= 4)
+    {
+      // 2 overlapping reads from each end cover 4 to 16 chars
+      CString::size_type middle = (length >> 3) << 2;
+      a = (wyRead4(ptr) << 32) | wyRead4(ptr + middle);
+      b = (wyRead4(ptr + length - 4) << 32) | wyRead4(ptr + length - 4 - middle);
+    }
+    else if(length > 0)
+    {
+      a = (static_cast<unsigned long long>(ptr[0]) << 16) |
+          (static_cast<unsigned long long>(ptr[length >> 1]) << 8) | ptr[length - 1];
+      b = 0;
+    }
+    else
+    {
+      a = b = 0;
+    }
+  }
+  else
+  {
+    CString::size_type remaining = length;
+    if(remaining > 48)
+    {
+      // 3 independent lanes, so the multiplies overlap
+      unsigned long long seed1 = seed;
+      unsigned long long seed2 = seed;
+      do
+      {
+        seed  = wyMix(wyRead8(ptr) ^ secret[1], wyRead8(ptr + 8) ^ seed);
+        seed1 = wyMix(wyRead8(ptr + 16) ^ secret[2], wyRead8(ptr + 24) ^ seed1);
+        seed2 = wyMix(wyRead8(ptr + 32) ^ secret[3], wyRead8(ptr + 40) ^ seed2);
+        ptr += 48;
+        remaining -= 48;
+      } while(remaining > 48);
+      seed ^= seed1 ^ seed2;
+    }
+
+    while(remaining > 16)
+    {
+      seed = wyMix(wyRead8(ptr) ^ secret[1], wyRead8(ptr + 8) ^ seed);
+      ptr += 16;
+      remaining -= 16;
+    }
+
+    // The last 16 chars, overlapping what was already mixed
+    a = wyRead8(ptr + remaining - 16);
+    b = wyRead8(ptr + remaining - 8);
+  }
+
+  a ^= secret[1];
+  b ^= seed;
+  wyMultiply(a, b);
+  unsigned long long hash = wyMix(a ^ secret[0] ^ length, b ^ secret[1]);
+
+  return static_cast<unsigned int>(hash ^ (hash >> 32));
+}
+
+static inline unsigned int hashChars(const char *ptr, CString::size_type length, CString::HashFunction function)
+{
+  return (function == CString::HASH_FAST) ? wyHash(ptr, length) : multiplyHash(ptr, length);
+}
+
+// Return the index of needle in haystack ignoring case, starting at index, or NPOS
+static CString::size_type findFoldedChars(const char *haystack,
+                                          CString::size_type hayLength,
+                                          const char *needle,
+                                          CString::size_type needleLength,
+                                          CString::size_type index)
+{
+  if(needleLength == 0)
+  {
+    return index;
+  }
+
+  if(needleLength == 1)
+  {
+    // Look for the lower case letter, then the upper case one before it
+    unsigned char lower = asciiLower(needle[0]);
+    CString::size_type found = findChar(haystack + index, hayLength - index, lower);
+    if(lower >= 'a' && lower <= 'z')
+    {
+      CString::size_type end = (found == CString::NPOS) ? hayLength - index : found;
+      CString::size_type foundUpper = findChar(haystack + index, end, lower - 0x20);
+      if(foundUpper != CString::NPOS)
+      {
+        found = foundUpper;
+      }
+    }
+    return (found == CString::NPOS) ? found : index + found;
+  }
+
+#ifdef CSTRING_SIMD
+  return cpuHasAvx2() ?
+      filterFindFoldedAvx2(haystack, hayLength, needle, needleLength, index) :
+      filterFindFoldedSse2(haystack, hayLength, needle, needleLength, index);
+#else
+  return twoWayFindFolded(haystack, hayLength, needle, needleLength, index);
+#endif
+}
+
+// Compare ignoring case like strcmp, a prefix comes before the longer string
+static int compareFoldedChars(const char *str1,
+                              CString::size_type length1,
+                              const char *str2,
+                              CString::size_type length2)
+{
+  CString::size_type minLength = (length1 < length2) ? length1 : length2;
+  CString::size_type i = mismatchFolded(str1, str2, minLength);
+  if(i < minLength)
+  {
+    return (int) asciiLower(str1[i]) - (int) asciiLower(str2[i]);
+  }
+
+  return (length1 < length2) ? -1 : ((length1 > length2) ? 1 : 0);
+}
+
+// Compare as unsigned bytes, the shorter string first if its the start of the other
+static int compareChars(const char *str1,
+                        CString::size_type length1,
+                        const char *str2,
+                        CString::size_type length2)
+{
+  CString::size_type minLength = (length1 < length2) ? length1 : length2;
+
+  // Strings sharing their data only differ by their lengths
+  int result = (str1 == str2) ? 0 : memcmp(str1, str2, minLength);
+  if(result != 0)
+  {
+    return result;
+  }
+
+  return (length1 < length2) ? -1 : ((length1 > length2) ? 1 : 0);
+}
+
+// Return the index of needle in haystack, starting at index, or NPOS.
+// table is the prepared Two-Way table, NULL to prepare it if needed.
+static CString::size_type findChars(const char *haystack,
+                                    CString::size_type hayLength,
+                                    const char *needle,
+                                    CString::size_type needleLength,
+                                    CString::size_type index,
+                                    const TwoWayTable *table = NULL)
+{
+  if(needleLength == 0)
+  {
+    return index;
+  }
+
+  if(needleLength == 1)
+  {
+    CString::size_type found = findChar(haystack + index, hayLength - index, needle[0]);
+    return (found == CString::NPOS) ? found : index + found;
+  }
+
+#ifdef CSTRING_SIMD
+  if(needleLength <= SHORT_NEEDLE_LENGTH)
+  {
+    return cpuHasAvx2() ?
+        filterFindAvx2(haystack, hayLength, needle, needleLength, index, table) :
+        filterFindSse2(haystack, hayLength, needle, needleLength, index, table);
+  }
+#endif
+
+  return twoWayFind(haystack, hayLength, needle, needleLength, index, table);
+}
+
+// Return the index of needle in haystack, searching backwards with
+// index counted from the end of haystack, or NPOS.
+// table is the prepared reverse Two-Way table, NULL to prepare it if needed.
+static CString::size_type rfindChars(const char *haystack,
+                                     CString::size_type hayLength,
+                                     const char *needle,
+                                     CString::size_type needleLength,
+                                     CString::size_type index,
+                                     const TwoWayTable *table = NULL)
+{
+  CString::size_type startpoint = hayLength - index - needleLength;
+  if(needleLength == 0)
+  {
+    return startpoint;
+  }
+
+  if(needleLength == 1)
+  {
+    return rfindChar(haystack, startpoint + 1, needle[0]);
+  }
+
+  // Only the chars before index (from the end) can hold the needle
+  CString::size_type searchLength = hayLength - index;
+
+#ifdef CSTRING_SIMD
+  if(needleLength <= SHORT_NEEDLE_LENGTH)
+  {
+    return cpuHasAvx2() ?
+        filterRfindAvx2(haystack, searchLength, needle, needleLength, table) :
+        filterRfindSse2(haystack, searchLength, needle, needleLength, table);
+  }
+#endif
+
+  return twoWayRfind(haystack, searchLength, needle, needleLength, table);
+}
+
+// True if findChars needs a Two-Way table for this needle, else it only
+// needs one when the vector filter gives up on repetitive input
+static inline bool needsTwoWayTable(CString::size_type needleLength)
+{
+#ifdef CSTRING_SIMD
+  return needleLength > SHORT_NEEDLE_LENGTH;
+#else
+  return needleLength > 1;
+#endif
+}
+
+// Write the index of each non overlapping needle in haystack, from index,
+// to indices, stopping when maxIndices are written. Returns the number written.
+// table is the prepared Two-Way table, NULL to prepare it if its needed.
+static CString::size_type findAllChars(const char *haystack,
+                                       CString::size_type hayLength,
+                                       const char *needle,
+                                       CString::size_type needleLength,
+                                       CString::size_type index,
+                                       CString::size_type *indices,
+                                       CString::size_type maxIndices,
+                                       const TwoWayTable *table = NULL)
+{
+  if(needleLength == 1)
+  {
+    return findAllChar(haystack + index, hayLength - index, needle[0], index, indices, maxIndices);
+  }
+
+  TwoWayTable localTable;
+  if(table == NULL && needsTwoWayTable(needleLength))
+  {
+    twoWayPrepareFind(localTable, needle, needleLength);
+    table = &localTable;
+  }
+
+  CString::size_type written = 0;
+  bool useTwoWay = needsTwoWayTable(needleLength);
+
+#ifdef CSTRING_SIMD
+  // One vector scan over the whole haystack, leaving the last
+  // few candidates, or repetitive input, to the loop below
+  if(! useTwoWay && needleLength <= hayLength - index)
+  {
+    written = cpuHasAvx2() ?
+        filterFindAllAvx2(haystack, hayLength, needle, needleLength, index, indices, maxIndices, useTwoWay) :
+        filterFindAllSse2(haystack, hayLength, needle, needleLength, index, indices, maxIndices, useTwoWay);
+    if(useTwoWay && table == NULL)
+    {
+      twoWayPrepareFind(localTable, needle, needleLength);
+      table = &localTable;
+    }
+  }
+#endif
+
+  while(written < maxIndices && needleLength <= hayLength - index)
+  {
+    CString::size_type found = useTwoWay ?
+        twoWayFind(haystack, hayLength, needle, needleLength, index, table) :
+        findChars(haystack, hayLength, needle, needleLength, index, table);
+    if(found == CString::NPOS)
+    {
+      break;
+    }
+    indices[written++] = found;
+    index = found + needleLength;
+  }
+
+  return written;
+}
+
+// Return the number of non overlapping needles in haystack, from index
+static CString::size_type countChars(const char *haystack,
+                                     CString::size_type hayLength,
+                                     const char *needle,
+                                     CString::size_type needleLength,
+                                     CString::size_type index,
+                                     const TwoWayTable *table = NULL)
+{
+  if(needleLength == 1)
+  {
+    return countChar(haystack + index, hayLength - index, needle[0]);
+  }
+
+  TwoWayTable localTable;
+  if(table == NULL && needsTwoWayTable(needleLength))
+  {
+    twoWayPrepareFind(localTable, needle, needleLength);
+    table = &localTable;
+  }
+
+  CString::size_type block[256];
+  CString::size_type total = 0;
+  CString::size_type written;
+  do
+  {
+    written = findAllChars(haystack, hayLength, needle, needleLength, index, block, 256, table);
+    total += written;
+    if(written > 0)
+    {
+      index = block[written - 1] + needleLength;
+    }
+  } while(written == 256);
+
+  return total;
+}
+
+// Call found(index) for each non overlapping needle in haystack from index,
+// in order. The matches are found a block at a time, so found() may modify
+// the haystack behind the last match.
+template <class Found>
+static void forEachMatch(const char *haystack,
+                         CString::size_type hayLength,
+                         const char *needle,
+                         CString::size_type needleLength,
+                         CString::size_type index,
+                         Found found)
+{
+  TwoWayTable table;
+  const TwoWayTable *tablePtr = NULL;
+  if(needsTwoWayTable(needleLength))
+  {
+    twoWayPrepareFind(table, needle, needleLength);
+    tablePtr = &table;
+  }
+
+  CString::size_type block[256];
+  CString::size_type written;
+  do
+  {
+    written = findAllChars(haystack, hayLength, needle, needleLength, index, block, 256, tablePtr);
+    for(CString::size_type i = 0; i < written; i++)
+    {
+      found(block[i]);
+    }
+    if(written > 0)
+    {
+      index = block[written - 1] + needleLength;
+    }
+  } while(written == 256);
+}
+
+//----------------------------------------------------------------------
+//
+//    CString implementation
+//      A NULL CStringData member means the string is stored inline in small_
+//----------------------------------------------------------------------
+
+CString::CString(size_type initialCapacity, bool autoCapacity) : // defaults to CString::INITIAL_CAPACITY, true
+  initialCapacity_(initialCapacity),
+  autoCapacity_(autoCapacity),
+  padChar_(DEFAULT_PAD_CHAR),
+  growthPolicy_(defaultGrowthPolicy_),
+  arena_(NULL)
+{
+  init("", 0);
+}
+
+CString::CString(const char *str, size_type initialCapacity, bool autoCapacity) : // defaults to CString::INITIAL_CAPACITY, true
+  initialCapacity_(initialCapacity),
+  autoCapacity_(autoCapacity),
+  padChar_(DEFAULT_PAD_CHAR),
+  growthPolicy_(defaultGrowthPolicy_),
+  arena_(NULL)
+{
+  init(str, strlen(str));
+}
+
+CString::CString(const char *str, size_type length, size_type initialCapacity, bool autoCapacity) : // defaults to true
+  initialCapacity_(initialCapacity),
+  autoCapacity_(autoCapacity),
+  padChar_(DEFAULT_PAD_CHAR),
+  growthPolicy_(defaultGrowthPolicy_),
+  arena_(NULL)
+{
+  init(str, length);
+}
+
+CString::CString(CStringArena &arena, size_type initialCapacity, bool autoCapacity) :
+  initialCapacity_(initialCapacity),
+  autoCapacity_(autoCapacity),
+  padChar_(DEFAULT_PAD_CHAR),
+  growthPolicy_(defaultGrowthPolicy_),
+  arena_(&arena)
+{
+  init("", 0);
+}
+
+CString::CString(CStringArena &arena, const char *str, size_type initialCapacity, bool autoCapacity) :
+  initialCapacity_(initialCapacity),
+  autoCapacity_(autoCapacity),
+  padChar_(DEFAULT_PAD_CHAR),
+  growthPolicy_(defaultGrowthPolicy_),
+  arena_(&arena)
+{
+  init(str, strlen(str));
+}
+
+CString::CString(CStringArena &arena, const char *str, size_type length, size_type initialCapacity, bool autoCapacity) :
+  initialCapacity_(initialCapacity),
+  autoCapacity_(autoCapacity),
+  padChar_(DEFAULT_PAD_CHAR),
+  growthPolicy_(defaultGrowthPolicy_),
+  arena_(&arena)
+{
+  init(str, length);
+}
+
+CString::CString(const CString &copY) :
+  data_(NULL),
+  padChar_(DEFAULT_PAD_CHAR)
+{
+  copy(copY);
+}
+
+CString::CString(CString &&movE) noexcept :
+  data_(NULL)
+{
+  move(movE);
+}
+
+#ifndef NO_OPERATORS
+CString &CString::operator=(const CString &copY)
+{
+  copy(copY);
+  return *this;
+}
+
+CString &CString::operator=(CString &&movE) noexcept
+{
+  if(this != &movE)
+  {
+    decrementReference();
+    move(movE);
+  }
+  return *this;
+}
+#endif
+
+CString::~CString()
+{
+  decrementReference();
+}
+
+// private
+void CString::init(const char *str, size_type length)
+{
+  size_type capacity = initialCapacity_;
+  if(length > capacity)
+  {
+    // TODO what if autoCapacity_ is false and the initial string is > than capacity?
+    capacity = length;
+  }
+
+  if(length > SMALL_CAPACITY)
+  {
+    data_ = CStringData::create(str, length, capacity, arena_);
+  }
+  else
+  {
+    data_ = NULL;
+    small_.capacity_ = capacity;
+    small_.size_ = length;
+    memcpy(small_.str_, str, length);
+    small_.str_[length] = '\0';
+  }
+}
+
+void CString::copy(const CString &copy)
+{
+  // Stop referring to the current data and refer to the data of another CString
+
+  if(this == &copy)
+  {
+    return;
+  }
+
+  // update the existing CStringData
+  decrementReference();
+
+  // now setup a "new" CStringData, inline strings are just copied
+  data_ = copy.data_;
+  if(data_ != NULL)
+  {
+    data_->addReference();
+  }
+  else
+  {
+    small_ = copy.small_;
+  }
+
+  initialCapacity_ = copy.initialCapacity_;
+  autoCapacity_ = copy.autoCapacity_;
+  padChar_ = copy.padChar_;
+  growthPolicy_ = copy.growthPolicy_;
+  arena_ = copy.arena_;
+}
+
+
+void CString::move(CString &movE) noexcept
+{
+  // Take over the data of another CString, no references are changed.
+  // The other CString is left as an empty inline string.
+
+  data_ = movE.data_;
+  if(data_ == NULL)
+  {
+    small_ = movE.small_;
+  }
+
+  initialCapacity_ = movE.initialCapacity_;
+  autoCapacity_ = movE.autoCapacity_;
+  padChar_ = movE.padChar_;
+  growthPolicy_ = movE.growthPolicy_;
+  arena_ = movE.arena_;
+
+  movE.data_ = NULL;
+  movE.small_.capacity_ = movE.initialCapacity_;
+  movE.small_.size_ = 0;
+  movE.small_.str_[0] = '\0';
+}
+
+// private
+void CString::decrementReference()
+{
+  if(data_ == NULL)
+  {
+    return;
+  }
+
+  if(data_->releaseReference())
+  {
+    CStringData::destroy(data_);
+  }
+
+  data_ = NULL;
+}
+
+// private
+void CString::makeRoom(size_type size)
+{
+  if(checkCapacity(size))
+  {
+    incrementCapacity(size);
+  }
+
+  // The logical capacity may be large enough while the inline buffer isnt
+  if(data_ == NULL && small_.size_ + size > SMALL_CAPACITY)
+  {
+    promote();
+  }
+
+  detach();
+}
+
+// private
+void CString::detach()
+{
+  // Copy on write: take a private copy of shared data before modifying it
+  if(data_ != NULL && data_->references() > 1)
+  {
+    CStringData *data = CStringData::create(data_->str(), data_->size_, data_->capacity_, arena_);
+    decrementReference();
+    data_ = data;
+  }
+  else if(data_ != NULL)
+  {
+    // The chars are about to change
+    data_->invalidateHash();
+  }
+}
+
+// private
+void CString::promote()
+{
+  // Move an inline string to a CStringData, keeping its logical capacity
+  data_ = CStringData::create(small_.str_, small_.size_, small_.capacity_, arena_);
+}
+
+// private
+void CString::incrementCapacity(size_type size)
+{
+  if(!autoCapacity_)
+  {
+    throw CStringOutOfBoundsException(
+        "Trying to increment capacity with autoCapacity set false");
+  }
+
+  setCapacity(grownCapacity(size));
+}
+
+// private
+// The capacity to grow to for size more chars, following the growth policy
+CString::size_type CString::grownCapacity(size_type size) const
+{
+  size_type capacity = getCapacity();
+  size_type needed = this->size() + size;
+
+  switch(growthPolicy_)
+  {
+    case GROWTH_GEOMETRIC:
+      capacity *= 2;
+      break;
+    case GROWTH_EXACT:
+      capacity = needed;
+      break;
+    default:
+      // Check that we increment enough to hold the new string
+      capacity += ((size > initialCapacity_) ? size : initialCapacity_);
+      break;
+  }
+
+  // Also covers doubling a capacity of 0, or overflowing
+  if(capacity < needed)
+  {
+    capacity = needed;
+  }
+
+  return capacity;
+}
+
+// private
+void CString::setCapacity(size_type capacity)
+{
+  if(data_ == NULL)
+  {
+    // Inline strings only track the capacity, makeRoom() promotes when needed
+    small_.capacity_ = capacity;
+    return;
+  }
+
+  if(data_->references() > 1)
+  {
+    // The block cant move while others refer to it, so leave it to
+    // them and continue with a copy
+    CStringData *data = CStringData::create(data_->str(), data_->size_, capacity, arena_);
+    decrementReference();
+    data_ = data;
+  }
+  else
+  {
+    data_ = CStringData::resize(data_, capacity);
+  }
+}
+
+void CString::reserve(size_type capacity)
+{
+  if(capacity <= getCapacity())
+  {
+    return;
+  }
+
+  if(!autoCapacity_)
+  {
+    throw CStringOutOfBoundsException(
+        "Trying to reserve capacity with autoCapacity set false");
+  }
+
+  // Allocate it now, thats the point of reserving
+  if(data_ == NULL && capacity > SMALL_CAPACITY)
+  {
+    promote();
+  }
+
+  setCapacity(capacity);
+}
+
+void CString::shrinkToFit()
+{
+  if(!autoCapacity_ || getCapacity() == size())
+  {
+    return;
+  }
+
+  if(data_ != NULL && size() <= SMALL_CAPACITY)
+  {
+    // Short enough to go back inline and release the data altogether
+    CStringData *data = data_;
+    init(data->str(), data->size_);
+    if(data->releaseReference())
+    {
+      CStringData::destroy(data);
+    }
+  }
+  else if(data_ != NULL && data_->references() > 1)
+  {
+    return;
+  }
+
+  setCapacity(size());
+}
+
+CString::size_type CString::getAllocatedBytes() const
+{
+  return (data_ == NULL) ? 0 : data_->getBlockSize();
+}
+
+void CString::clear()
+{
+  if(data_ != NULL && data_->references() > 1)
+  {
+    // Dont copy shared data just to clear it, go back to an empty inline string
+    size_type capacity = data_->capacity_;
+    decrementReference();
+    init("", 0);
+    small_.capacity_ = capacity;
+  }
+  else
+  {
+    setSize(0);
+  }
+}
+
+/** @brief clone
+  *
+  */
+CString CString::clone() const
+{
+  CString returnStr(str(), size(), getCapacity(), autoCapacity_);
+  returnStr.initialCapacity_ = initialCapacity_;
+  returnStr.padChar_ = padChar_;
+  returnStr.growthPolicy_ = growthPolicy_;
+
+  return returnStr;
+}
+
+void CString::toupper()
+{
+  detach();
+  convertCase(str(), buffer(), size(), 'a');
+}
+
+void CString::tolower()
+{
+  detach();
+  convertCase(str(), buffer(), size(), 'A');
+}
+
+void CString::toupper(CString &dest) const
+{
+  convertCase_(dest, 'a');
+}
+
+void CString::tolower(CString &dest) const
+{
+  convertCase_(dest, 'A');
+}
+
+void CString::toupper(char *dest) const
+{
+  convertCase(str(), dest, size(), 'a');
+  dest[size()] = '\0';
+}
+
+void CString::tolower(char *dest) const
+{
+  convertCase(str(), dest, size(), 'A');
+  dest[size()] = '\0';
+}
+
+// private
+void CString::convertCase_(CString &dest, char first) const
+{
+  if(&dest == this)
+  {
+    dest.detach();
+    convertCase(str(), dest.buffer(), size(), first);
+    return;
+  }
+
+  // Convert straight into dest, reusing its capacity
+  dest.clear();
+  dest.makeRoom(size());
+  convertCase(str(), dest.buffer(), size(), first);
+  dest.setSize(size());
+}
+
+bool CString::isNumber() const
+{
+  if(empty())
+  {
+    return false;
+  }
+
+  // Get past the leading spaces
+  int i = 0;
+  while(str()[i++] == ' ' && i < size()) {}
+
+  bool trailingSpaces = false;
+  for(int j = i; j < size(); j++)
+  {
+    const char c = str()[j];
+    if(c == ' ')
+    {
+      trailingSpaces = true; // "1234 "
+    }
+    else if(c < '0' || c > '9')
+    {
+      if(trailingSpaces)
+      {
+        return false; // "123 4"
+      }
+
+      if(c == '-' && j == i) // leading minus sign
+      {
+        continue;
+      }
+      else if(c == ',' || c == '.')
+      {
+        // no checking as to number of ',' or '.' since in Europe they
+        // use the '.' as a thousands marker, whereas in many other places
+        // they use the ',' as a thousands marker.
+        continue;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else
+    {
+      if(trailingSpaces)
+      {
+        return false; // "123 4"
+      }
+    }
+  }
+
+  return true;
+}
+
+/** @brief substr
+  *
+  */
+CString CString::substr(size_type index, size_type numChars) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::substr index > size");
+  }
+
+  if(numChars == CString::NPOS)
+  {
+    numChars = size() - index;
+  }
+
+  if(index+numChars > size())
+  {
+    throw CStringOutOfBoundsException("CString::substr index+numChars > size");
+  }
+
+  // Substrings of arena strings come from the same arena
+  if(arena_ != NULL)
+  {
+    return CString(*arena_, str()+index, numChars, DEFAULT_CAPACITY);
+  }
+
+  CString returnStr(str()+index, numChars, DEFAULT_CAPACITY);
+
+  return returnStr;
+}
+
+/** @brief substrView
+  *
+  */
+CStringView CString::substrView(size_type index, size_type numChars) const
+{
+  return CStringView(*this, index, numChars);
+}
+
+/** @brief begin
+  *
+  */
+CStringIterator CString::iterator() const
+{
+  return CStringIterator(*this);
+}
+
+/** @brief rbegin
+  *
+  */
+CStringReverseIterator CString::riterator() const
+{
+  return CStringReverseIterator(*this);
+}
+
+const char CString::index(size_type indeX) const
+{
+  if(indeX > size())
+  {
+    throw CStringOutOfBoundsException("CString::index index > size");
+  }
+
+  return str()[indeX];
+}
+
+/** @brief equals
+  *
+  */
+bool CString::equals(const CString &str) const
+{
+  if(str.size() != size())
+  {
+    return false;
+  }
+
+  if(data_ != NULL && str.data_ != NULL)
+  {
+    if(data_ == str.data_)
+    {
+      return true;
+    }
+
+    // Different cached hashes cant be the same chars
+    for(unsigned int function = HASH_DEFAULT; function <= HASH_FAST; function++)
+    {
+      unsigned int hash1 = data_->getHash(function);
+      unsigned int hash2 = str.data_->getHash(function);
+      if(hash1 != 0 && hash2 != 0 && hash1 != hash2)
+      {
+        return false;
+      }
+    }
+  }
+
+  return memcmp(this->str(), str.str(), size()) == 0;
+}
+
+// private
+int CString::compare_(const char *str, size_type length) const
+{
+  return compareChars(this->str(), size(), str, length);
+}
+
+/** @brief hash
+  *
+  */
+unsigned int CString::hash(HashFunction function) const
+{
+  if(data_ == NULL)
+  {
+    return hashChars(str(), size(), function);
+  }
+
+  unsigned int hash = data_->getHash(function);
+  if(hash == 0)
+  {
+    hash = hashChars(str(), size(), function);
+    data_->setHash(function, hash);
+  }
+
+  return hash;
+}
+
+/** @brief find_
+  *
+  */
+// private
+CString::size_type
+CString::find_(const char *str, CString::size_type index, CString::size_type length) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::find index > size");
+  }
+
+  if(index+length > size())
+  {
+    throw CStringInvalidArgException("CString::find index+length > size");
+  }
+
+  return findChars(this->str(), size(), str, length, index);
+}
+
+
+/** @brief find_
+  *
+  */
+// private
+CString::size_type
+CString::rfind_(const char *str, CString::size_type index, CString::size_type length) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::rfind index > size");
+  }
+
+  if(index+length > size())
+  {
+    throw CStringInvalidArgException("CString::rfind index+length > size");
+  }
+
+  return rfindChars(this->str(), size(), str, length, index);
+}
+
+// private
+CString::size_type
+CString::findIgnoreCase_(const char *str, CString::size_type index, CString::size_type length) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::findIgnoreCase index > size");
+  }
+
+  if(index+length > size())
+  {
+    throw CStringInvalidArgException("CString::findIgnoreCase index+length > size");
+  }
+
+  return findFoldedChars(this->str(), size(), str, length, index);
+}
+
+// private
+int CString::compareIgnoreCase_(const char *str, size_type length) const
+{
+  return compareFoldedChars(this->str(), size(), str, length);
+}
+
+// private
+CString::size_type
+CString::findAll_(const char *str, size_type length, size_type index,
+                  size_type *indices, size_type maxIndices) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::findAll index > size");
+  }
+
+  if(length == 0)
+  {
+    throw CStringInvalidArgException("CString::findAll empty string");
+  }
+
+  return findAllChars(this->str(), size(), str, length, index, indices, maxIndices);
+}
+
+// private
+CString::size_type
+CString::findAll_(const char *str, size_type length, size_type index,
+                  std::vector<size_type> &indices) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::findAll index > size");
+  }
+
+  if(length == 0)
+  {
+    throw CStringInvalidArgException("CString::findAll empty string");
+  }
+
+  size_type total = 0;
+  forEachMatch(this->str(), size(), str, length, index, [&](size_type pos)
+  {
+    indices.push_back(pos);
+    total++;
+  });
+
+  return total;
+}
+
+// private
+CString::size_type
+CString::count_(const char *str, size_type length, size_type index) const
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::count index > size");
+  }
+
+  if(length == 0)
+  {
+    throw CStringInvalidArgException("CString::count empty string");
+  }
+
+  return countChars(this->str(), size(), str, length, index);
+}
+
+/** @brief append_
+  *
+  */
+// private
+CString::size_type CString::append_(const char *strData,
+                                    CString::size_type length,
+                                    CString::size_type minWidth,
+                                    bool leftJustify)
+{
+  size_type totalLength = (length < minWidth) ? minWidth : length;
+
+  makeRoom(totalLength);
+
+  size_type appendIndex = size();
+
+  // pad spaces
+  if( length < minWidth)
+  {
+    size_type padStart;
+    size_type padLength;
+    if(leftJustify)
+    {
+      padStart = size();
+      padLength = size() + (minWidth - length);
+      appendIndex = padLength;
+    }
+    else
+    {
+      padStart = size() + length;
+      padLength = size() + minWidth;
+    }
+
+    memset(buffer() + padStart, padChar_, padLength - padStart);
+  }
+
+  memcpy(buffer() + appendIndex, strData, length);
+  setSize(size() + totalLength);
+
+  return totalLength;
+}
+
+/** @brief insert
+  *
+  */
+CString::size_type
+CString::insert(const char ch,
+                CString::size_type index,
+                CString::size_type minWidth,
+                bool leftJustify,
+                CString::size_type count)
+{
+  char temp[count];
+  memset(temp, ch, count);
+
+  return insert_(temp, index, count, minWidth, leftJustify);
+}
+
+CString::size_type
+CString::insert(int num,
+                CString::size_type index,
+                CString::size_type minWidth,
+                bool leftJustify,
+                CString::size_type count)
+{
+  char temp[10*count]; // a max int wont be more than 10 digits
+  int numDigits = 0;
+
+  for(int i = 0; i < count; i++)
+  {
+    numDigits += sprintf(temp + numDigits, "%d", num);
+  }
+
+  return insert_(temp, index, numDigits, minWidth, leftJustify);
+}
+
+CString::size_type
+CString::insert(long num,
+                CString::size_type index,
+                CString::size_type minWidth,
+                bool leftJustify,
+                CString::size_type count)
+{
+  char temp[20*count]; // a max long wont be more than 20 digits
+  int numDigits = 0;
+
+  for(int i = 0; i < count; i++)
+  {
+    numDigits += sprintf(temp + numDigits, "%ld", num);
+  }
+
+  return insert_(temp, index, numDigits, minWidth, leftJustify);
+}
+
+CString::size_type
+CString::insert(float num,
+                CString::size_type index,
+                CString::size_type numDecimals,
+                CString::size_type minWidth,
+                bool leftJustify,
+                CString::size_type count)
+{
+  char temp[20*count]; // a max float wont be more than 30 digits
+  int numDigits = 0;
+
+  for(int i = 0; i < count; i++)
+  {
+    numDigits += sprintf(temp + numDigits, "%.*f", numDecimals, num);
+  }
+
+  return insert_(temp, index, numDigits, minWidth, leftJustify);
+}
+
+CString::size_type
+CString::insert(bool b,
+                size_type index,
+                bool displayText,
+                CString::size_type minWidth,
+                bool leftJustify,
+                size_type count)
+{
+  char temp[5*count]; // max str size will be "false"
+  int numDigits = 0;
+
+  for(int i = 0; i < count; i++)
+  {
+    if(displayText)
+    {
+      numDigits += sprintf(temp + numDigits, (b ? "true" : "false"));
+    }
+    else
+    {
+      temp[numDigits++] = (b ? '1' : '0');
+    }
+  }
+
+  return insert_(temp, index, numDigits, minWidth, leftJustify);
+}
+
+// TODO allow to specify format string
+CString::size_type
+CString::insertHex(int num,
+                   CString::size_type index,
+                   CString::size_type minWidth,
+                   bool leftJustify,
+                   CString::size_type count)
+{
+  // a max int wont be more than 10 digits, and 2 hex digits per int digit plus 2 leading chars 0x
+  char temp[22*count];
+  int numDigits = 0;
+
+  for(int i = 0; i < count; i++)
+  {
+    numDigits += sprintf(temp + numDigits, "%X", num);
+  }
+
+  return insert_(temp, index, numDigits, minWidth, leftJustify);
+}
+
+/** @brief insert_
+  *
+  */
+// private
+CString::size_type
+CString::insert_(const char *strData,
+                 CString::size_type index,
+                 CString::size_type length,
+                 CString::size_type minWidth,
+                 bool leftJustify)
+{
+  if(index == CString::NPOS)
+  {
+    index = size();
+  }
+
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::insert index > size");
+  }
+
+  size_type totalLength = (length < minWidth) ? minWidth : length;
+
+  makeRoom(totalLength);
+
+  // If inserting in the middle of the string, move the chars from index
+  // to the end of the string up to make room, as replace() does. If
+  // index = size(), then its an append and there is nothing to move.
+  size_type substrLen = size()-index;
+  if(substrLen > 0)
+  {
+    memmove(buffer()+index+totalLength, str()+index, substrLen);
+  }
+
+  size_type insertIndex = index;
+
+  // pad spaces
+  if( length < minWidth)
+  {
+    size_type padStart;
+    size_type padLength;
+    if(leftJustify)
+    {
+      padStart = index;
+      padLength = index + (minWidth - length);
+      insertIndex = padLength;
+    }
+    else
+    {
+      padStart = index + length;
+      padLength = index + minWidth;
+    }
+
+    memset(buffer() + padStart, padChar_, padLength - padStart);
+  }
+
+  // Insert the string
+  memcpy(buffer()+insertIndex, strData, length);
+
+  // Always terminate the string
+  setSize(size() + totalLength);
+
+  return totalLength;
+}
+
+/** @brief remove
+  *
+  */
+CString::size_type
+CString::remove(CString::size_type index, CString::size_type numChars)
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::remove index > size");
+  }
+
+  // Remove to end of string
+  if(numChars == CString::NPOS)
+  {
+    numChars = size() - index;
+  }
+
+  if(numChars+index > size())
+  {
+    throw CStringInvalidArgException("CString::remove numChars+index > size");
+  }
+
+  detach();
+
+  // If we're removing until end of string, we dont need the memcpy
+  if(numChars+index != size())
+  {
+    memmove(buffer()+index, str()+index+numChars, size()-index-numChars);
+  }
+
+  setSize(size() - numChars);
+
+  return numChars;
+}
+
+/** @brief replace
+  *
+  */
+CString::size_type
+CString::replace(const char ch, CString::size_type index, CString::size_type count, CString::size_type length)
+{
+  memset(replaceRoom(index, length, count), ch, count);
+
+  return length;
+}
+
+/** @brief replace
+  *
+  */
+// private
+CString::size_type
+CString::replace_(const char *strData,
+                  CString::size_type strDataLength,
+                  CString::size_type index,
+                  CString::size_type length)
+{
+  memcpy(replaceRoom(index, length, strDataLength), strData, strDataLength);
+
+  return length;
+}
+
+/** @brief replaceRoom
+  *
+  */
+// private
+// Make the length chars at index newLength chars long, moving the rest of
+// the string, and return where to write the new chars. length is adjusted
+// as described for replace().
+char *
+CString::replaceRoom(CString::size_type index,
+                     CString::size_type &length,
+                     CString::size_type newLength)
+{
+  if(index > size())
+  {
+    throw CStringOutOfBoundsException("CString::replace index > size");
+  }
+
+  if(length == CString::NPOS)
+  {
+    length = size();
+  }
+
+  if(length == 0)
+  {
+    length = newLength;
+  }
+
+  // if(length > newLength)
+  //     str="abcdefgh", replace("xyz", 2, 4) => str="abxyzgh", size reduced
+  // if(length < newLength)
+  //     str="abcdefgh", replace("xyz", 2, 2) => str="abxyzefgh", size increased
+
+  // The chars after the replaced ones, none if replacing off the end of the string
+  size_type tailSize = (length + index < size()) ? size() - (length + index) : 0;
+
+  // Replacing off end of string or with a longer string, make sure it fits
+  size_type newSize = index + newLength + tailSize;
+  if(newSize > size())
+  {
+    makeRoom(newSize - size());
+  }
+  else
+  {
+    detach();
+  }
+
+  if(tailSize > 0)
+  {
+    memmove(buffer()+index+newLength, str()+index+length, tailSize);
+  }
+  setSize(newSize);
+
+  return buffer()+index;
+}
+
+/** @brief replaceAll
+  *
+  */
+CString::size_type
+CString::replaceAll(const char ch, const char replacement)
+{
+  size_type indices[256];
+  size_type written = findAllChar(str(), size(), ch, 0, indices, 256);
+  if(written == 0)
+  {
+    return 0;
+  }
+
+  if(ch == replacement)
+  {
+    return count(ch);
+  }
+
+  detach();
+  char *buf = buffer();
+  size_type numReplaced = 0;
+  while(written > 0)
+  {
+    for(size_type i = 0; i < written; i++)
+    {
+      buf[indices[i]] = replacement;
+    }
+    numReplaced += written;
+
+    size_type index = indices[written - 1] + 1;
+    written = findAllChar(buf + index, size() - index, ch, index, indices, 256);
+  }
+
+  return numReplaced;
+}
+
+/** @brief replaceAll_
+  *
+  */
+// private
+CString::size_type
+CString::replaceAll_(const char *strData,
+                     CString::size_type length,
+                     const char *replacement,
+                     CString::size_type replacementLength)
+{
+  if(length == 0)
+  {
+    throw CStringInvalidArgException("CString::replaceAll empty string");
+  }
+
+  const char *text = str();
+  const size_type textSize = size();
+
+  // The needle or replacement may be chars of this string,
+  // they have to stay as they are until the end
+  const char *textEnd = text + ((data_ == NULL) ? SMALL_CAPACITY : getCapacity()) + 1;
+  bool aliased = (strData < textEnd && strData + length > text) ||
+                 (replacement < textEnd && replacement + replacementLength > text);
+  bool shared = (data_ != NULL && data_->references() > 1);
+
+  if(replacementLength <= length && !shared && !aliased)
+  {
+    // The result is never longer than what it replaces, so its
+    // written behind the scan, which only reads ahead of it
+    char *buf = buffer();
+    size_type src = 0;
+    size_type dst = 0;
+    size_type numReplaced = 0;
+    forEachMatch(buf, textSize, strData, length, 0, [&](size_type pos)
+    {
+      memmove(buf+dst, buf+src, pos-src);
+      dst += pos-src;
+      memcpy(buf+dst, replacement, replacementLength);
+      dst += replacementLength;
+      src = pos+length;
+      numReplaced++;
+    });
+
+    if(numReplaced > 0)
+    {
+      memmove(buf+dst, buf+src, textSize-src);
+      setSize(dst + textSize-src);
+    }
+
+    return numReplaced;
+  }
+
+  size_type numReplaced = countChars(text, textSize, strData, length, 0);
+  if(numReplaced == 0)
+  {
+    return 0;
+  }
+
+  size_type newSize = textSize - numReplaced*length + numReplaced*replacementLength;
+  size_type capacity = getCapacity();
+  if(newSize > capacity)
+  {
+    if(!autoCapacity_)
+    {
+      throw CStringOutOfBoundsException(
+          "Trying to increment capacity with autoCapacity set false");
+    }
+    capacity = grownCapacity(newSize - textSize);
+  }
+
+  // Build the result in new data, or in a temp if it stays inline
+  char smallTemp[SMALL_CAPACITY+1];
+  CStringData *newData = NULL;
+  char *out = smallTemp;
+  if(data_ != NULL || newSize > SMALL_CAPACITY)
+  {
+    newData = CStringData::create("", 0, capacity, arena_);
+    out = newData->str();
+  }
+
+  size_type src = 0;
+  size_type dst = 0;
+  forEachMatch(text, textSize, strData, length, 0, [&](size_type pos)
+  {
+    memcpy(out+dst, text+src, pos-src);
+    dst += pos-src;
+    memcpy(out+dst, replacement, replacementLength);
+    dst += replacementLength;
+    src = pos+length;
+  });
+  memcpy(out+dst, text+src, textSize-src);
+
+  if(newData != NULL)
+  {
+    decrementReference();
+    data_ = newData;
+  }
+  else
+  {
+    memcpy(small_.str_, smallTemp, newSize);
+    small_.capacity_ = capacity;
+  }
+  setSize(newSize);
+
+  return numReplaced;
+}
+
+//----------------------------------------------------------------------
+//
+//    CStringView implementation
+//
+//----------------------------------------------------------------------
+
+CStringView::CStringView() :
+    offset_(0),
+    length_(0)
+{
+}
+
+CStringView::CStringView(const CString &str, size_type index, size_type numChars) :
+    str_(str),
+    offset_(index),
+    length_(numChars)
+{
+  if(index > str.size())
+  {
+    throw CStringOutOfBoundsException("CStringView index > size");
+  }
+
+  if(numChars == CString::NPOS)
+  {
+    length_ = str.size() - index;
+  }
+
+  if(index+length_ > str.size())
+  {
+    throw CStringOutOfBoundsException("CStringView index+numChars > size");
+  }
+}
+
+CString CStringView::toCString() const
+{
+  if(offset_ == 0 && length_ == str_.size())
+  {
+    return str_;
+  }
+
+  return str_.substr(offset_, length_);
+}
+
+CStringView CStringView::substr(size_type index, size_type numChars) const
+{
+  if(index > length_)
+  {
+    throw CStringOutOfBoundsException("CStringView::substr index > size");
+  }
+
+  if(numChars == CString::NPOS)
+  {
+    numChars = length_ - index;
+  }
+
+  if(index+numChars > length_)
+  {
+    throw CStringOutOfBoundsException("CStringView::substr index+numChars > size");
+  }
+
+  return CStringView(str_, offset_+index, numChars);
+}
+
+const char CStringView::index(size_type indeX) const
+{
+  if(indeX > length_)
+  {
+    throw CStringOutOfBoundsException("CStringView::index index > size");
+  }
+
+  // index == size returns the end of line, like CString::index
+  return (indeX == length_) ? '\0' : data()[indeX];
+}
+
+unsigned int CStringView::hash(CString::HashFunction function) const
+{
+  // A view of the whole string can use its cached hash
+  if(offset_ == 0 && length_ == str_.size())
+  {
+    return str_.hash(function);
+  }
+
+  return hashChars(data(), length_, function);
+}
+
+CStringIterator CStringView::iterator() const
+{
+  return CStringIterator(*this);
+}
+
+CStringReverseIterator CStringView::riterator() const
+{
+  return CStringReverseIterator(*this);
+}
+
+// private
+CStringView::size_type
+CStringView::find_(const char *str, size_type index, size_type length) const
+{
+  if(index > length_)
+  {
+    throw CStringOutOfBoundsException("CStringView::find index > size");
+  }
+
+  if(index+length > length_)
+  {
+    throw CStringInvalidArgException("CStringView::find index+length > size");
+  }
+
+  return findChars(data(), length_, str, length, index);
+}
+
+// private
+CStringView::size_type
+CStringView::rfind_(const char *str, size_type index, size_type length) const
+{
+  if(index > length_)
+  {
+    throw CStringOutOfBoundsException("CStringView::rfind index > size");
+  }
+
+  if(index+length > length_)
+  {
+    throw CStringInvalidArgException("CStringView::rfind index+length > size");
+  }
+
+  return rfindChars(data(), length_, str, length, index);
+}
+
+// private
+CStringView::size_type
+CStringView::findIgnoreCase_(const char *str, size_type index, size_type length) const
+{
+  if(index > length_)
+  {
+    throw CStringOutOfBoundsException("CStringView::findIgnoreCase index > size");
+  }
+
+  if(index+length > length_)
+  {
+    throw CStringInvalidArgException("CStringView::findIgnoreCase index+length > size");
+  }
+
+  return findFoldedChars(data(), length_, str, length, index);
+}
+
+// private
+int CStringView::compareIgnoreCase_(const char *str, size_type length) const
+{
+  return compareFoldedChars(data(), length_, str, length);
+}
+
+// private
+int CStringView::compare_(const char *str, size_type length) const
+{
+  return compareChars(data(), length_, str, length);
+}
+
+//----------------------------------------------------------------------
+//
+//    CStringSearcher implementation
+//
+//----------------------------------------------------------------------
+
+// Single char needles use the char kernels, and dont need the tables
+struct CStringSearcher::SearchTables
+{
+  TwoWayTable forward_;
+  TwoWayTable reverse_;
+};
+
+CStringSearcher::CStringSearcher(const char *needle) :
+    needle_(needle),
+    tables_(NULL)
+{
+  prepare();
+}
+
+CStringSearcher::CStringSearcher(const CString &needle) :
+    needle_(needle),
+    tables_(NULL)
+{
+  prepare();
+}
+
+CStringSearcher::CStringSearcher(const CStringSearcher &copy) :
+    needle_(copy.needle_),
+    tables_((copy.tables_ == NULL) ? NULL : new SearchTables(*copy.tables_))
+{
+}
+
+CStringSearcher::CStringSearcher(CStringSearcher &&movE) noexcept :
+    needle_(std::move(movE.needle_)),
+    tables_(movE.tables_)
+{
+  movE.tables_ = NULL;
+}
+
+// virtual
+CStringSearcher::~CStringSearcher()
+{
+  delete tables_;
+}
+
+#ifndef NO_OPERATORS
+CStringSearcher &CStringSearcher::operator=(const CStringSearcher &rhs)
+{
+  if(this != &rhs)
+  {
+    SearchTables *tables = (rhs.tables_ == NULL) ? NULL : new SearchTables(*rhs.tables_);
+    delete tables_;
+    tables_ = tables;
+    needle_ = rhs.needle_;
+  }
+
+  return *this;
+}
+
+CStringSearcher &CStringSearcher::operator=(CStringSearcher &&rhs) noexcept
+{
+  if(this != &rhs)
+  {
+    delete tables_;
+    tables_ = rhs.tables_;
+    rhs.tables_ = NULL;
+    needle_ = std::move(rhs.needle_);
+  }
+
+  return *this;
+}
+#endif
+
+// private
+void CStringSearcher::prepare()
+{
+  if(needle_.empty())
+  {
+    throw CStringInvalidArgException("CStringSearcher empty needle");
+  }
+
+  if(needle_.size() > 1)
+  {
+    tables_ = new SearchTables;
+    twoWayPrepareFind(tables_->forward_, needle_.str(), needle_.size());
+    twoWayPrepareRfind(tables_->reverse_, needle_.str(), needle_.size());
+  }
+}
+
+// private
+CStringSearcher::size_type
+CStringSearcher::find_(const char *haystack, size_type length, size_type index) const
+{
+  if(index > length)
+  {
+    throw CStringOutOfBoundsException("CStringSearcher::find index > size");
+  }
+
+  if(needle_.empty() || needle_.size() > length - index)
+  {
+    return CString::NPOS;
+  }
+
+  return findChars(haystack, length, needle_.str(), needle_.size(), index,
+                   (tables_ == NULL) ? NULL : &tables_->forward_);
+}
+
+// private
+CStringSearcher::size_type
+CStringSearcher::rfind_(const char *haystack, size_type length, size_type index) const
+{
+  if(index > length)
+  {
+    throw CStringOutOfBoundsException("CStringSearcher::rfind index > size");
+  }
+
+  if(needle_.empty() || needle_.size() > length - index)
+  {
+    return CString::NPOS;
+  }
+
+  return rfindChars(haystack, length, needle_.str(), needle_.size(), index,
+                    (tables_ == NULL) ? NULL : &tables_->reverse_);
+}
+
+// private
+CStringSearcher::size_type
+CStringSearcher::count_(const char *haystack, size_type length) const
+{
+  const size_type needleLength = needle_.size();
+  if(needleLength == 0)
+  {
+    return 0;
+  }
+
+  return countChars(haystack, length, needle_.str(), needleLength, 0,
+                    (tables_ == NULL) ? NULL : &tables_->forward_);
+}
+
+//----------------------------------------------------------------------
+//
+//    CStringMultiSearcher implementation
+//
+//----------------------------------------------------------------------
+
+// Set in a transition when the next state has matches
+static const CString::size_type OUTPUT_FLAG = 0x80000000;
+
+CStringMultiSearcher::CStringMultiSearcher(const std::vector<CString> &patterns) :
+    patterns_(patterns),
+    numClasses_(0),
+    numStates_(0)
+{
+  compile();
+}
+
+CStringMultiSearcher::CStringMultiSearcher(const char **patterns, size_type numPatterns) :
+    numClasses_(0),
+    numStates_(0)
+{
+  patterns_.reserve(numPatterns);
+  for(size_type i = 0; i < numPatterns; i++)
+  {
+    patterns_.push_back(CString(patterns[i]));
+  }
+
+  compile();
+}
+
+// virtual
+CStringMultiSearcher::~CStringMultiSearcher()
+{
+}
+
+// private
+void CStringMultiSearcher::compile()
+{
+  // Bytes used by the patterns get a class each, the rest share class 0
+  unsigned long long totalLength = 0;
+  memset(byteClass_, 0, sizeof(byteClass_));
+  for(size_type p = 0; p < patterns_.size(); p++)
+  {
+    if(patterns_[p].empty())
+    {
+      throw CStringInvalidArgException("CStringMultiSearcher empty pattern");
+    }
+
+    const unsigned char *str = reinterpret_cast<const unsigned char *>(patterns_[p].str());
+    for(size_type i = 0; i < patterns_[p].size(); i++)
+    {
+      byteClass_[str[i]] = 1;
+    }
+    totalLength += patterns_[p].size();
+  }
+
+  numClasses_ = 1;
+  for(int b = 0; b < 256; b++)
+  {
+    if(byteClass_[b] != 0)
+    {
+      byteClass_[b] = numClasses_++;
+    }
+  }
+
+  if((totalLength + 1) * numClasses_ >= OUTPUT_FLAG)
+  {
+    throw CStringInvalidArgException("CStringMultiSearcher patterns too long");
+  }
+
+  // The trie of the patterns, NPOS where there is no child
+  std::vector<size_type> trie(numClasses_, CString::NPOS);
+  std::vector<size_type> patternState(patterns_.size());
+  numStates_ = 1;
+  for(size_type p = 0; p < patterns_.size(); p++)
+  {
+    const unsigned char *str = reinterpret_cast<const unsigned char *>(patterns_[p].str());
+    size_type state = 0;
+    for(size_type i = 0; i < patterns_[p].size(); i++)
+    {
+      size_type slot = state * numClasses_ + byteClass_[str[i]];
+      if(trie[slot] == CString::NPOS)
+      {
+        trie[slot] = numStates_++;
+        trie.resize(numStates_ * numClasses_, CString::NPOS);
+      }
+      state = trie[slot];
+    }
+    patternState[p] = state;
+  }
+
+  // Renumber the states breadth first
+  std::vector<size_type> order;
+  std::vector<size_type> newId(numStates_, 0);
+  order.reserve(numStates_);
+  order.push_back(0);
+  for(size_type head = 0; head < order.size(); head++)
+  {
+    for(size_type c = 0; c < numClasses_; c++)
+    {
+      size_type child = trie[order[head] * numClasses_ + c];
+      if(child != CString::NPOS)
+      {
+        newId[child] = order.size();
+        order.push_back(child);
+      }
+    }
+  }
+
+  // Listed backwards so each state lists its patterns in id order
+  firstOutput_.assign(numStates_, CString::NPOS);
+  nextOutput_.assign(patterns_.size(), CString::NPOS);
+  for(size_type p = patterns_.size(); p-- > 0; )
+  {
+    size_type state = newId[patternState[p]];
+    nextOutput_[p] = firstOutput_[state];
+    firstOutput_[state] = p;
+  }
+
+  // Fill in the transitions breadth first. The failure state of a state
+  // is shallower, so its transitions are already complete when needed.
+  std::vector<size_type> failure(numStates_, 0);
+  transitions_.assign(numStates_ * numClasses_, 0);
+  outputLink_.assign(numStates_, CString::NPOS);
+  for(size_type state = 0; state < numStates_; state++)
+  {
+    size_type row = state * numClasses_;
+    size_type failureRow = failure[state] * numClasses_;
+    for(size_type c = 0; c < numClasses_; c++)
+    {
+      size_type child = trie[order[state] * numClasses_ + c];
+      if(child == CString::NPOS)
+      {
+        transitions_[row + c] = (state == 0) ? 0 : transitions_[failureRow + c];
+        continue;
+      }
+
+      child = newId[child];
+      size_type childFailure = (state == 0) ? 0 : (transitions_[failureRow + c] & ~OUTPUT_FLAG) / numClasses_;
+      failure[child] = childFailure;
+      outputLink_[child] = (firstOutput_[childFailure] != CString::NPOS) ? childFailure : outputLink_[childFailure];
+
+      bool hasOutput = (firstOutput_[child] != CString::NPOS || outputLink_[child] != CString::NPOS);
+      transitions_[row + c] = child * numClasses_ | (hasOutput ? OUTPUT_FLAG : 0);
+    }
+  }
+}
+
+// private
+CStringMultiSearcher::size_type
+CStringMultiSearcher::findAll_(const char *haystack, size_type length, std::vector<Match> &matches) const
+{
+  const unsigned char *str = reinterpret_cast<const unsigned char *>(haystack);
+  const size_type *transitions = transitions_.data();
+  size_type numFound = 0;
+  size_type row = 0;
+
+  for(size_type i = 0; i < length; i++)
+  {
+    row = transitions[row + byteClass_[str[i]]];
+    if(row & OUTPUT_FLAG)
+    {
+      row &= ~OUTPUT_FLAG;
+      for(size_type state = row / numClasses_; state != CString::NPOS; state = outputLink_[state])
+      {
+        for(size_type p = firstOutput_[state]; p != CString::NPOS; p = nextOutput_[p])
+        {
+          Match match = { p, i + 1 - patterns_[p].size() };
+          matches.push_back(match);
+          numFound++;
+        }
+      }
+    }
+  }
+
+  return numFound;
+}
+
+// private
+bool CStringMultiSearcher::findFirst_(const char *haystack, size_type length, Match &match) const
+{
+  const unsigned char *str = reinterpret_cast<const unsigned char *>(haystack);
+  const size_type *transitions = transitions_.data();
+  size_type row = 0;
+
+  for(size_type i = 0; i < length; i++)
+  {
+    row = transitions[row + byteClass_[str[i]]];
+    if(row & OUTPUT_FLAG)
+    {
+      // The state's own patterns are longer than those on its output link
+      size_type state = (row & ~OUTPUT_FLAG) / numClasses_;
+      if(firstOutput_[state] == CString::NPOS)
+      {
+        state = outputLink_[state];
+      }
+      match.pattern_ = firstOutput_[state];
+      match.index_ = i + 1 - patterns_[match.pattern_].size();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//----------------------------------------------------------------------
+//
+//    CStringTokenizer implementation
+//
+//----------------------------------------------------------------------
+
+CStringTokenizer::CStringTokenizer(const char *str, const char *token) :
+    inputStr_(str),
+    token_(token),
+    index_(0)
+{
+  prepare();
+}
+
+CStringTokenizer::CStringTokenizer(const char *str, const CString &token) :
+    inputStr_(str),
+    token_(token),
+    index_(0)
+{
+  prepare();
+}
+
+CStringTokenizer::CStringTokenizer(const CString &str, const char *token) :
+    inputStr_(str),
+    token_(token),
+    index_(0)
+{
+  prepare();
+}
+
+CStringTokenizer::CStringTokenizer(const CString &str, const CString &token) :
+    inputStr_(str),
+    token_(token),
+    index_(0)
+{
+  prepare();
+}
+
+CStringTokenizer::CStringTokenizer(CStringTokenizer &&cst) noexcept :
+    inputStr_(std::move(cst.inputStr_)),
+    token_(std::move(cst.token_)),
+    index_(cst.index_)
+{
+  memcpy(delimiters_, cst.delimiters_, sizeof(delimiters_));
+  cst.index_ = CString::NPOS;
+}
+
+#ifndef NO_OPERATORS
+CStringTokenizer &CStringTokenizer::operator=(CStringTokenizer &&cst) noexcept
+{
+  inputStr_ = std::move(cst.inputStr_);
+  token_ = std::move(cst.token_);
+  index_ = cst.index_;
+  memcpy(delimiters_, cst.delimiters_, sizeof(delimiters_));
+  cst.index_ = CString::NPOS;
+
+  return *this;
+}
+#endif
+
+// virtual
+CStringTokenizer::~CStringTokenizer()
+{
+}
+
+CString CStringTokenizer::next()
+{
+  CString::size_type offset;
+  CString::size_type length;
+  if(!next(offset, length))
+  {
+    return CString();
+  }
+
+  return inputStr_.substr(offset, length);
+}
+
+bool CStringTokenizer::next(CStringView &token)
+{
+  CString::size_type offset;
+  CString::size_type length;
+  if(!next(offset, length))
+  {
+    return false;
+  }
+
+  // Only share the input the first time, after that just move the view
+  if(token.str_.str() != inputStr_.str())
+  {
+    token.str_.copy(inputStr_);
+  }
+  token.offset_ = offset;
+  token.length_ = length;
+
+  return true;
+}
+
+bool CStringTokenizer::next(CString::size_type &offset, CString::size_type &length)
+{
+  // Check if there are no more tokens
+  if(index_ == CString::NPOS)
+  {
+    return false;
+  }
+
+  const char *input = inputStr_.str();
+  CString::size_type size = inputStr_.size();
+  CString::size_type startIndex = index_;
+
+  // Find the end of the current token
+  CString::size_type endIndex = startIndex + findDelimiter_(input + startIndex, size - startIndex, true);
+  offset = startIndex;
+  length = endIndex - startIndex;
+
+  // If the delimiter wasnt found, either we're at the end of the string,
+  // or it didnt exist. The token is from startIndex to end of string
+  if(endIndex == size)
+  {
+    index_ = CString::NPOS;
+    return true;
+  }
+
+  // Now skip the delimiters to the beginning of the next token
+  CString::size_type nextIndex = endIndex + findDelimiter_(input + endIndex, size - endIndex, false);
+  index_ = (nextIndex == size) ? CString::NPOS : nextIndex;
+
+  return true;
+}
+
+// Add the tokens of input that start in [begin, end) to tokens. The last
+// one may end after end. A token starts at a non delimiter char that is
+// the first char of the input or follows a delimiter.
+static void splitRegion(const char *input,
+                        CString::size_type size,
+                        CString::size_type begin,
+                        CString::size_type end,
+                        const unsigned char *table,
+                        const CString &token,
+                        std::vector<CStringTokenizer::Token> &tokens)
+{
+  CString::size_type index = begin;
+
+  // The token the region starts in the middle of belongs to the region before
+  if(begin > 0 && table[static_cast<unsigned char>(input[begin - 1])] == 0)
+  {
+    index += findDelimiter(input + index, size - index, table, token.str(), token.size(), true);
+  }
+
+  while(index < end)
+  {
+    index += findDelimiter(input + index, size - index, table, token.str(), token.size(), false);
+    if(index >= end)
+    {
+      break;
+    }
+
+    CStringTokenizer::Token found;
+    found.offset_ = index;
+    found.length_ = findDelimiter(input + index, size - index, table, token.str(), token.size(), true);
+    tokens.push_back(found);
+    index += found.length_;
+  }
+}
+
+// Set the entries of the chars in token to 1, and the others to 0
+static void prepareDelimiters(unsigned char *delimiters, const CString &token)
+{
+  memset(delimiters, 0, 256);
+  for(CString::size_type i = 0; i < token.size(); i++)
+  {
+    delimiters[static_cast<unsigned char>(token.str()[i])] = 1;
+  }
+}
+
+// static
+void CStringTokenizer::split(const CString &str, const char *token, std::vector<Token> &tokens, unsigned int numThreads)
+{
+  split(str, CString(token), tokens, numThreads);
+}
+
+// static
+void CStringTokenizer::split(const CString &str, const CString &token, std::vector<Token> &tokens, unsigned int numThreads)
+{
+  unsigned char delimiters[256];
+  prepareDelimiters(delimiters, token);
+  const char *input = str.str();
+  CString::size_type size = str.size();
+
+  tokens.clear();
+
+  // Like next(), a delimiter or nothing at the start is an empty first token
+  if(size == 0 || delimiters[static_cast<unsigned char>(input[0])] != 0)
+  {
+    Token empty = { 0, 0 };
+    tokens.push_back(empty);
+  }
+
+  if(numThreads == 0)
+  {
+    // hardware_concurrency() is 0 when it cant tell
+    numThreads = std::thread::hardware_concurrency();
+    if(numThreads == 0)
+    {
+      numThreads = 1;
+    }
+  }
+  CString::size_type maxThreads = size / MIN_SPLIT_REGION;
+  if(numThreads > maxThreads)
+  {
+    numThreads = (maxThreads > 0) ? maxThreads : 1;
+  }
+
+  if(numThreads == 1)
+  {
+    splitRegion(input, size, 0, size, delimiters, token, tokens);
+    return;
+  }
+
+  // Each thread fills its own vector, appended in region order at the end
+  std::vector<std::vector<Token> > regionTokens(numThreads);
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads);
+  CString::size_type regionSize = size / numThreads;
+  try
+  {
+    for(unsigned int t = 0; t < numThreads; t++)
+    {
+      CString::size_type begin = t * regionSize;
+      CString::size_type end = (t == numThreads - 1) ? size : begin + regionSize;
+      std::vector<Token> *regionResult = &regionTokens[t];
+      threads.emplace_back([=, &token, &delimiters]()
+      {
+        splitRegion(input, size, begin, end, delimiters, token, *regionResult);
+      });
+    }
+  }
+  catch(...)
+  {
+    // A joinable thread destroyed with the vector would terminate the program
+    for(unsigned int t = 0; t < threads.size(); t++)
+    {
+      threads[t].join();
+    }
+    throw;
+  }
+
+  CString::size_type numTokens = tokens.size();
+  for(unsigned int t = 0; t < numThreads; t++)
+  {
+    threads[t].join();
+    numTokens += regionTokens[t].size();
+  }
+
+  tokens.reserve(numTokens);
+  for(unsigned int t = 0; t < numThreads; t++)
+  {
+    tokens.insert(tokens.end(), regionTokens[t].begin(), regionTokens[t].end());
+  }
+}
+
+// private
+void CStringTokenizer::prepare()
+{
+  prepareDelimiters(delimiters_, token_);
+}
+
+// private
+CString::size_type CStringTokenizer::findDelimiter_(const char *ptr, CString::size_type length, bool isDelimiter) const
+{
+  return findDelimiter(ptr, length, delimiters_, token_.str(), token_.size(), isDelimiter);
+}
+
+//----------------------------------------------------------------------
+//
+//    CStringStreamTokenizer implementation
+//
+//----------------------------------------------------------------------
+
+// Read from fd, retrying reads interrupted by a signal
+static CStringStreamTokenizer::ReadFunction fdReader(int fd)
+{
+  return [fd](char *buffer, CString::size_type length) -> long
+  {
+    ssize_t numRead;
+    do
+    {
+      numRead = ::read(fd, buffer, length);
+    } while(numRead < 0 && errno == EINTR);
+
+    return numRead;
+  };
+}
+
+CStringStreamTokenizer::CStringStreamTokenizer(int fd, const char *token, CString::size_type chunkSize) :
+    CStringStreamTokenizer(fdReader(fd), token, chunkSize)
+{
+}
+
+CStringStreamTokenizer::CStringStreamTokenizer(int fd, const CString &token, CString::size_type chunkSize) :
+    CStringStreamTokenizer(fdReader(fd), token, chunkSize)
+{
+}
+
+CStringStreamTokenizer::CStringStreamTokenizer(const ReadFunction &read, const char *token, CString::size_type chunkSize) :
+    read_(read),
+    token_(token),
+    chunkSize_(chunkSize),
+    buffer_(2 * chunkSize),
+    index_(0),
+    skipping_(false),
+    eof_(false),
+    done_(false)
+{
+  prepare();
+}
+
+CStringStreamTokenizer::CStringStreamTokenizer(const ReadFunction &read, const CString &token, CString::size_type chunkSize) :
+    read_(read),
+    token_(token),
+    chunkSize_(chunkSize),
+    buffer_(2 * chunkSize),
+    index_(0),
+    skipping_(false),
+    eof_(false),
+    done_(false)
+{
+  prepare();
+}
+
+// virtual
+CStringStreamTokenizer::~CStringStreamTokenizer()
+{
+}
+
+CString CStringStreamTokenizer::next()
+{
+  CString::size_type offset;
+  CString::size_type length;
+  if(!next_(offset, length))
+  {
+    return CString();
+  }
+
+  return buffer_.substr(offset, length);
+}
+
+bool CStringStreamTokenizer::next(CStringView &token)
+{
+  // Release the buffer before its refilled, so it isnt copied on write
+  token.str_.clear();
+  token.offset_ = 0;
+  token.length_ = 0;
+
+  CString::size_type offset;
+  CString::size_type length;
+  if(!next_(offset, length))
+  {
+    return false;
+  }
+
+  token.str_.copy(buffer_);
+  token.offset_ = offset;
+  token.length_ = length;
+
+  return true;
+}
+
+bool CStringStreamTokenizer::next(const char *&token, CString::size_type &length)
+{
+  CString::size_type offset;
+  if(!next_(offset, length))
+  {
+    return false;
+  }
+
+  token = buffer_.str() + offset;
+
+  return true;
+}
+
+// private
+void CStringStreamTokenizer::prepare()
+{
+  if(chunkSize_ == 0)
+  {
+    throw CStringInvalidArgException("CStringStreamTokenizer chunkSize is 0");
+  }
+
+  prepareDelimiters(delimiters_, token_);
+}
+
+// private
+// Drop the chars before index_ and read the next chunk after the rest.
+// Returns false at the end of the input.
+bool CStringStreamTokenizer::fill()
+{
+  if(eof_)
+  {
+    return false;
+  }
+
+  if(index_ > 0)
+  {
+    buffer_.remove(0, index_);
+    index_ = 0;
+  }
+
+  // Only grows when a token doesnt fit in the buffer
+  buffer_.makeRoom(chunkSize_);
+  long numRead = read_(buffer_.buffer() + buffer_.size(), chunkSize_);
+  if(numRead < 0)
+  {
+    throw CStringIOException("CStringStreamTokenizer read failed");
+  }
+
+  if(numRead == 0)
+  {
+    eof_ = true;
+    return false;
+  }
+
+  buffer_.setSize(buffer_.size() + numRead);
+
+  return true;
+}
+
+// private
+bool CStringStreamTokenizer::next_(CString::size_type &offset, CString::size_type &length)
+{
+  if(done_)
+  {
+    return false;
+  }
+
+  // Skip the delimiters after the previous token, reading while they last.
+  // Like CStringTokenizer, delimiters at the end of the input end it.
+  if(skipping_)
+  {
+    index_ += findDelimiter_(index_, false);
+    while(index_ == buffer_.size())
+    {
+      if(!fill())
+      {
+        done_ = true;
+        return false;
+      }
+      index_ += findDelimiter_(index_, false);
+    }
+    skipping_ = false;
+  }
+
+  // Find the end of the token, reading while it lasts. The chars already
+  // scanned arent scanned again after the buffer is refilled.
+  CString::size_type scanned = findDelimiter_(index_, true);
+  while(index_ + scanned == buffer_.size())
+  {
+    if(!fill())
+    {
+      // The last token runs to the end of the input
+      offset = index_;
+      length = scanned;
+      done_ = true;
+      return true;
+    }
+    scanned += findDelimiter_(index_ + scanned, true);
+  }
+
+  offset = index_;
+  length = scanned;
+  index_ += scanned;
+  skipping_ = true;
+
+  return true;
+}
+
+// private
+CString::size_type CStringStreamTokenizer::findDelimiter_(CString::size_type index, bool isDelimiter) const
+{
+  return findDelimiter(buffer_.str() + index, buffer_.size() - index,
+                       delimiters_, token_.str(), token_.size(), isDelimiter);
+}
+
+//----------------------------------------------------------------------
+//
+//    CStringRecordSplitter implementation
+//      The chars that matter are found with the delimiter kernels, so
+//      unquoted fields are scanned 16 or 32 chars at a time.
+//----------------------------------------------------------------------
+
+CStringRecordSplitter::CStringRecordSplitter(char delimiter, char quote, char escape) :
+    delimiter_(delimiter),
+    quote_(quote),
+    escape_(escape),
+    numFieldChars_(0),
+    numQuotedChars_(0)
+{
+  if(delimiter == '\0' || delimiter == '\n' || delimiter == '\r' || escape == '\n' || escape == '\r' ||
+     (quote != '\0' && (quote == delimiter || quote == escape)) || escape == delimiter)
+  {
+    throw CStringInvalidArgException("CStringRecordSplitter invalid delimiter, quote or escape");
+  }
+
+  fieldChars_[numFieldChars_++] = delimiter;
+  fieldChars_[numFieldChars_++] = '\n';
+  fieldChars_[numFieldChars_++] = '\r';
+  if(quote != '\0')
+  {
+    quotedChars_[numQuotedChars_++] = quote;
+  }
+  if(escape != '\0')
+  {
+    fieldChars_[numFieldChars_++] = escape;
+    quotedChars_[numQuotedChars_++] = escape;
+  }
+
+  memset(fieldTable_, 0, sizeof(fieldTable_));
+  memset(quotedTable_, 0, sizeof(quotedTable_));
+  for(CString::size_type i = 0; i < numFieldChars_; i++)
+  {
+    fieldTable_[static_cast<unsigned char>(fieldChars_[i])] = 1;
+  }
+  for(CString::size_type i = 0; i < numQuotedChars_; i++)
+  {
+    quotedTable_[static_cast<unsigned char>(quotedChars_[i])] = 1;
+  }
+}
+
+CString::size_type
+CStringRecordSplitter::next(const char *input, CString::size_type length, CString::size_type &index,
+                            Field *fields, CString::size_type maxFields) const
+{
+  if(index >= length)
+  {
+    return 0;
+  }
+
+  CString::size_type numFields = 0;
+  CString::size_type pos = index;
+  bool moreFields = true;
+  while(moreFields)
+  {
+    Field field;
+    moreFields = nextField_(input, length, pos, field);
+    if(numFields < maxFields)
+    {
+      fields[numFields] = field;
+    }
+    numFields++;
+  }
+  index = pos;
+
+  return numFields;
+}
+
+CString::size_type
+CStringRecordSplitter::next(const CString &input, CString::size_type &index, std::vector<Field> &fields) const
+{
+  if(index >= input.size())
+  {
+    fields.clear();
+    return 0;
+  }
+
+  // Split straight into the vector, only growing it when a record has
+  // more fields than the ones before it
+  CString::size_type numFields = 0;
+  CString::size_type pos = index;
+  bool moreFields = true;
+  while(moreFields)
+  {
+    if(numFields == fields.size())
+    {
+      fields.resize((numFields > 0) ? 2 * numFields : 16);
+    }
+    moreFields = nextField_(input.str(), input.size(), pos, fields[numFields]);
+    numFields++;
+  }
+  fields.resize(numFields);
+  index = pos;
+
+  return numFields;
+}
+
+// private
+// Split the field starting at pos into field, and move pos past the
+// delimiter after it. Returns false if the field is the last one of the
+// record, with pos past the end of line or at the end of the input.
+bool
+CStringRecordSplitter::nextField_(const char *input, CString::size_type length, CString::size_type &pos, Field &field) const
+{
+  field.escaped_ = false;
+  field.quoted_ = (quote_ != '\0' && pos < length && input[pos] == quote_);
+
+  if(field.quoted_)
+  {
+    // Find the closing quote, skipping doubled quotes and escaped chars
+    field.offset_ = ++pos;
+    while(true)
+    {
+      pos += findDelimiter(input + pos, length - pos, quotedTable_, quotedChars_, numQuotedChars_, true);
+      if(pos >= length)
+      {
+        throw CStringInvalidArgException("CStringRecordSplitter quote not closed");
+      }
+
+      bool doubled = (input[pos] == quote_ && pos + 1 < length && input[pos + 1] == quote_);
+      if(input[pos] == quote_ && !doubled)
+      {
+        break;
+      }
+
+      field.escaped_ = true;
+      pos = (pos + 2 < length) ? pos + 2 : length;
+    }
+    field.length_ = pos - field.offset_;
+    pos++;
+  }
+  else
+  {
+    // Find the delimiter or end of line, skipping escaped chars and a lone '\r'
+    field.offset_ = pos;
+    while(true)
+    {
+      pos += findDelimiter(input + pos, length - pos, fieldTable_, fieldChars_, numFieldChars_, true);
+      if(pos >= length || input[pos] == delimiter_ || input[pos] == '\n' ||
+         (input[pos] == '\r' && pos + 1 < length && input[pos + 1] == '\n'))
+      {
+        break;
+      }
+
+      if(input[pos] == escape_)
+      {
+        field.escaped_ = true;
+        pos = (pos + 2 < length) ? pos + 2 : length;
+      }
+      else
+      {
+        pos++;
+      }
+    }
+    field.length_ = pos - field.offset_;
+  }
+
+  // Now at the delimiter before the next field, the end of the record, or the end of the input
+  if(pos >= length)
+  {
+    pos = length;
+    return false;
+  }
+
+  if(input[pos] == delimiter_)
+  {
+    pos++;
+    return true;
+  }
+
+  if(input[pos] == '\r' && pos + 1 < length && input[pos + 1] == '\n')
+  {
+    pos++;
+  }
+
+  if(input[pos] == '\n')
+  {
+    pos++;
+    return false;
+  }
+
+  throw CStringInvalidArgException("CStringRecordSplitter chars after a closing quote");
+}
+
+void CStringRecordSplitter::unescape(const char *input, const Field &field, CString &dest) const
+{
+  dest.clear();
+  const char *ptr = input + field.offset_;
+  if(!field.escaped_)
+  {
+    dest.append_(ptr, field.length_, 0, false);
+    return;
+  }
+
+  // Append the runs of plain chars, and the char after each quote or escape
+  CString::size_type start = 0;
+  for(CString::size_type i = 0; i < field.length_; i++)
+  {
+    if((ptr[i] == escape_ && escape_ != '\0') || (field.quoted_ && ptr[i] == quote_))
+    {
+      dest.append_(ptr + start, i - start, 0, false);
+      start = ++i;
+    }
+  }
+  dest.append_(ptr + start, field.length_ - start, 0, false);
 }
@@ -2,28 +2,200 @@
 #define CSTRING_H
 
 #include <string.h>
+#include <functional>
+#include <vector>
 
+// The reference counts are atomic so CStrings sharing data can be used
+// from different threads. Define SINGLE_THREADED to use plain counters.
+#ifndef SINGLE_THREADED
+#include <atomic>
+#endif
+
+/**
+ * A bump pointer region allocator for CStrings. CStrings created with an
+ * arena take their CStringData from it, and all the memory is released at
+ * once when the arena is reset or destroyed, without freeing each string.
+ * CStrings using the arena, and copies of them, must not be used after that,
+ * use CString::clone() to get a copy that doesnt use the arena.
+ * An arena must only be used by one thread at a time.
+ */
+class CStringArena
+{
+  public:
+    typedef unsigned int size_type;
+    static const size_type DEFAULT_BLOCK_SIZE;
+
+    CStringArena(size_type blockSize = CStringArena::DEFAULT_BLOCK_SIZE);
+    ~CStringArena();
+
+    /**
+     * Return size bytes, suitably aligned. Allocations larger than
+     * the block size get a block of their own.
+     */
+    void *allocate(size_type size);
+
+    /**
+     * Grow or shrink the most recent allocation in place.
+     * Returns false if ptr isnt the most recent allocation, or it doesnt fit.
+     */
+    bool extend(void *ptr, size_type oldSize, size_type newSize);
+
+    /**
+     * Release all the allocations at once, the first block is kept for reuse.
+     */
+    void reset();
+
+    inline size_type getBytesUsed()      const { return bytesUsed_; };
+    inline size_type getBytesAllocated() const { return bytesAllocated_; };
+
+  private:
+    // these are disallowed
+    CStringArena(const CStringArena &);
+    void operator=(const CStringArena &);
+
+    struct Block
+    {
+      Block *next_;
+      size_type size_;
+      size_type used_;
+      inline char *data() { return reinterpret_cast<char *>(this + 1); };
+    };
+
+    Block *newBlock(size_type size);
+
+    Block *blocks_; // the current block, followed by the older ones
+    size_type blockSize_;
+    size_type bytesUsed_;
+    size_type bytesAllocated_;
+};
+
+/**
+ * Per thread free lists of heap CStringData blocks, by size class.
+ * Blocks up to MAX_BLOCK_SIZE bytes are rounded up to a power of 2 size
+ * class, and when released are kept on the releasing thread's free list
+ * for that class instead of being freed, up to getMaxFreeBlocks() blocks
+ * per size class. Larger blocks use malloc, realloc and free directly.
+ */
+class CStringPool
+{
+  public:
+    typedef unsigned int size_type;
+    static const size_type MIN_BLOCK_SIZE = 32;
+    static const size_type MAX_BLOCK_SIZE = 4096;
+    static const size_type DEFAULT_MAX_FREE_BLOCKS = 64;
+
+    // These throw std::bad_alloc if the memory cant be allocated
+    static void *allocate(size_type size);
+    // The number of bytes actually allocated for a block of size bytes
+    static size_type getBlockSize(size_type size);
+    static void *reallocate(void *block, size_type oldSize, size_type newSize);
+    static void release(void *block, size_type size);
+
+    /**
+     * The max number of free blocks kept per size class, per thread.
+     * 0 disables the pooling. Should be set before CStrings are
+     * created in other threads.
+     */
+    static size_type getMaxFreeBlocks()         { return maxFreeBlocks_; };
+    static void setMaxFreeBlocks(size_type max) { maxFreeBlocks_ = max; };
+
+    /**
+     * Free the blocks kept by the calling thread. Each thread's blocks
+     * are also freed when the thread exits.
+     */
+    static void trim();
+
+    // The number of free blocks kept by the calling thread
+    static size_type getFreeBlocks();
+
+  private:
+    static size_type maxFreeBlocks_;
+};
+
+/**
+ * The shared, reference counted string data. The header and the chars
+ * are allocated in one block, the chars immediately follow the header.
+ * Use create() and destroy() instead of new and delete.
+ */
 class CStringData
 {
 	public:
     typedef unsigned int size_type;
 
-		CStringData(CStringData::size_type initialCapacity, bool autoCapacity);
-		CStringData(const char *str, CStringData::size_type initialCapacity, bool autoCapacity);
-		CStringData(const char *str, CStringData::size_type length, CStringData::size_type initialCapacity, bool autoCapacity);
+    /**
+     * Allocate a block with room for capacity chars plus the end of line,
+     * and copy length chars of str into it. The references are set to 1.
+     * The block comes from the arena if there is one, else from the heap.
+     */
+    static CStringData *create(const char *str,
+                               CStringData::size_type length,
+                               CStringData::size_type capacity,
+                               CStringArena *arena = NULL);
 
-		~CStringData();
+    /**
+     * Grow or shrink the block to hold capacity chars. The block may move,
+     * so only call this when there is just 1 reference, and use the returned pointer.
+     * Arena blocks are grown in place if they are the arena's most recent allocation.
+     */
+    static CStringData *resize(CStringData *data, CStringData::size_type capacity);
+
+    static void destroy(CStringData *data);
+
+    // The number of bytes allocated for the block, including the header
+    CStringData::size_type getBlockSize() const;
+
+    inline char *str()             { return reinterpret_cast<char *>(this + 1); };
+    inline const char *str() const { return reinterpret_cast<const char *>(this + 1); };
+
+    /**
+     * Reference counting, releaseReference() returns true if the last
+     * reference was released, in which case the caller must destroy the data.
+     */
+#ifndef SINGLE_THREADED
+    inline void addReference()          { references_.fetch_add(1, std::memory_order_relaxed); };
+    inline bool releaseReference()      { return references_.fetch_sub(1, std::memory_order_acq_rel) == 1; };
+    inline unsigned int references() const { return references_.load(std::memory_order_acquire); };
+#else
+    inline void addReference()          { references_++; };
+    inline bool releaseReference()      { return --references_ == 0; };
+    inline unsigned int references() const { return references_; };
+#endif
 
+    /**
+     * The hashes of the chars cached by CString::hash(), one per hash function.
+     * 0 means not computed yet, so a hash that really is 0 is just computed
+     * each time. Mutators clear them, see CString::detach() and setSize().
+     */
+#ifndef SINGLE_THREADED
+    inline unsigned int getHash(unsigned int function) const { return hashes_[function].load(std::memory_order_relaxed); };
+    inline void setHash(unsigned int function, unsigned int hash) { hashes_[function].store(hash, std::memory_order_relaxed); };
+#else
+    inline unsigned int getHash(unsigned int function) const { return hashes_[function]; };
+    inline void setHash(unsigned int function, unsigned int hash) { hashes_[function] = hash; };
+#endif
+    inline void invalidateHash() { setHash(0, 0); setHash(1, 0); };
+
+#ifndef SINGLE_THREADED
+    std::atomic<unsigned int> references_;
+    std::atomic<unsigned int> hashes_[2];
+#else
     unsigned int references_;
-		CStringData::size_type initialCapacity_;
+    unsigned int hashes_[2];
+#endif
 		CStringData::size_type capacity_;
-    bool autoCapacity_;
     CStringData::size_type size_;
-    char *str_;
+    CStringArena *arena_; // NULL if allocated on the heap
+
+  private:
+    // these are disallowed, use create() and destroy()
+    CStringData(CStringData::size_type length, CStringData::size_type capacity, CStringArena *arena);
+    ~CStringData();
+    CStringData(const CStringData &);
 };
 
 class CStringIterator;
 class CStringReverseIterator;
+class CStringView;
 
 class CString
 {
@@ -32,21 +204,88 @@ class CString
     static const size_type DEFAULT_CAPACITY;
     static const char DEFAULT_PAD_CHAR;
     static const size_type NPOS;
+    // Strings up to this size are stored inline without allocating a CStringData
+    static const size_type SMALL_CAPACITY = 15;
+
+    /**
+     * The hash functions hash() can use
+     */
+    enum HashFunction
+    {
+      HASH_DEFAULT, // hash * 31 + c a char at a time, the values hash() has always returned
+      HASH_FAST     // wyhash, a word at a time, faster on long strings and better distributed
+    };
+
+    /**
+     * How the capacity is incremented when the string outgrows it
+     */
+    enum GrowthPolicy
+    {
+      GROWTH_LINEAR,    // grow by the size needed or the initialCapacity, whichever is larger
+      GROWTH_GEOMETRIC, // double the capacity, or grow to the size needed if thats larger
+      GROWTH_EXACT      // grow to exactly the size needed
+    };
 
     CString(size_type initialCapacity = CString::DEFAULT_CAPACITY, bool autoCapacity = true);
     CString(const char *str, size_type initialCapacity = CString::DEFAULT_CAPACITY, bool autoCapacity = true);
     CString(const char *str, size_type length, size_type initialCapacity, bool autoCapacity = true);
+    // These allocate from the arena, see CStringArena
+    CString(CStringArena &arena, size_type initialCapacity = CString::DEFAULT_CAPACITY, bool autoCapacity = true);
+    CString(CStringArena &arena, const char *str, size_type initialCapacity = CString::DEFAULT_CAPACITY, bool autoCapacity = true);
+    CString(CStringArena &arena, const char *str, size_type length, size_type initialCapacity, bool autoCapacity = true);
     CString(const CString &copy);
+    // The moved from CString is left empty
+    CString(CString &&movE) noexcept;
     virtual ~CString();
 
-    inline bool empty()            const { return data_->size_ < 1; };
-    inline size_type size()        const { return data_->size_; };
-    inline const char *str()       const { return data_->str_; };
-    inline size_type getCapacity() const { return data_->capacity_; };
-    inline bool getAutoCapacity()  const { return data_->autoCapacity_; };
-    inline void clear() { data_->size_ = 0; data_->str_[0] = '\0'; };
+    inline bool empty()            const { return size() < 1; };
+    inline size_type size()        const { return (data_ == NULL) ? small_.size_ : data_->size_; };
+    inline const char *str()       const { return (data_ == NULL) ? small_.str_ : data_->str(); };
+    inline size_type getCapacity() const { return (data_ == NULL) ? small_.capacity_ : data_->capacity_; };
+    inline bool getAutoCapacity()  const { return autoCapacity_; };
+    inline CStringArena *getArena() const { return arena_; };
+    void clear();
+
+    /**
+     * The growth policy is copied along with the string. New CStrings use
+     * the default growth policy, which is GROWTH_LINEAR unless changed.
+     * The default should be set before CStrings are created in other threads.
+     */
+    inline GrowthPolicy getGrowthPolicy() const          { return growthPolicy_; };
+    inline void setGrowthPolicy(GrowthPolicy policy)     { growthPolicy_ = policy; };
+    static GrowthPolicy getDefaultGrowthPolicy()         { return defaultGrowthPolicy_; };
+    static void setDefaultGrowthPolicy(GrowthPolicy policy) { defaultGrowthPolicy_ = policy; };
+
+    /**
+     * Make sure the capacity is at least capacity chars, so that many chars
+     * can be appended without incrementing the capacity again.
+     * If autoCapacity is false and capacity > getCapacity(),
+     * CStringOutOfBoundsException will be thrown.
+     */
+    void reserve(size_type capacity);
+
+    /**
+     * Reduce the capacity to the size of the string, releasing the unused memory.
+     * Does nothing if autoCapacity is false, since the capacity is then a fixed limit.
+     * Shared data is only shrunk if the string fits inline, since shrinking
+     * would otherwise need a copy, using more memory instead of less.
+     */
+    void shrinkToFit();
+
+    /**
+     * Return the number of bytes allocated for the string data, including
+     * the CStringData header. Inline strings dont allocate and return 0.
+     * Copies share the data, so the bytes are counted for each copy.
+     */
+    size_type getAllocatedBytes() const;
+
+    /**
+     * Copies of a CString share the same data until one of them is modified,
+     * at which point the modified CString takes a private copy (copy on write).
+     * Return a copy of the string that doesnt share the data, and doesnt use an arena.
+     */
+    CString clone() const;
 
-    // TODO CString clone() const; copy the string without reference counting
     // TODO for insert, append: allow width and left/right justify
     //      ej: str="123" w=5, left, result= "  123" or right: "123  "
     // TODO add insert signature with iterators
@@ -54,9 +293,27 @@ class CString
     CStringIterator iterator() const;
     CStringReverseIterator riterator() const;
 
+    /**
+     * Convert the ASCII letters to upper or lower case in place,
+     * other bytes are left as they are.
+     */
     void toupper();
     void tolower();
 
+    /**
+     * Write this string converted to upper or lower case into dest, replacing
+     * its contents and reusing its capacity. This string is not modified.
+     */
+    void toupper(CString &dest) const;
+    void tolower(CString &dest) const;
+
+    /**
+     * Write this string converted to upper or lower case into dest,
+     * which must hold at least size() + 1 chars. dest is null terminated.
+     */
+    void toupper(char *dest) const;
+    void tolower(char *dest) const;
+
     /**
      * Returns true if the stored string is any sort of number, false otherwise.
      * Examples that would return true include:
@@ -181,8 +438,22 @@ class CString
      * Return the number of chars replaced
      */
     size_type replace(const char ch, size_type index = 0, size_type count = 1, size_type length = 0);
-    inline size_type replace(const char *str, size_type index = 0, size_type length = 0)    { return replace_(str, index, length); };
-    inline size_type replace(const CString &str, size_type index = 0, size_type length = 0) { return replace_(str.str(), index, length); };
+    inline size_type replace(const char *str, size_type index = 0, size_type length = 0)    { return replace_(str, strlen(str), index, length); };
+    inline size_type replace(const CString &str, size_type index = 0, size_type length = 0) { return replace_(str.str(), str.size(), index, length); };
+
+    /**
+     * Replace every occurrence of str/char with replacement, left to right
+     * without overlapping, and return the number replaced. The string is
+     * rebuilt in one pass, in place if replacement isnt longer than str,
+     * else into new data allocated once at the final size.
+     * Throws CStringInvalidArgException if str is empty.
+     * Examples:
+     *   str = "a.b.c", replaceAll('.', '/') results in "a/b/c"
+     *   str = "aaaa", replaceAll("aa", "b") results in "bb"
+     */
+    size_type replaceAll(const char ch, const char replacement);
+    inline size_type replaceAll(const char *str, const char *replacement)       { return replaceAll_(str, strlen(str), replacement, strlen(replacement)); };
+    inline size_type replaceAll(const CString &str, const CString &replacement) { return replaceAll_(str.str(), str.size(), replacement.str(), replacement.size()); };
 
     /**
      * Remove chars from the string starting at index until index+numChars.
@@ -210,6 +481,29 @@ class CString
     inline size_type rfind(const char *str, size_type index = 0)    const { return rfind_(str, index, strlen(str)); };
     inline size_type rfind(const CString &str, size_type index = 0) const { return rfind_(str.str(), index, str.size()); };
 
+    /**
+     * Find every occurrence of the str/char passed in, starting at index, in
+     * one scan. Occurrences dont overlap, the scan continues after each one.
+     * The buffer versions write at most maxIndices indices and return the
+     * number written, call again after the last one to continue.
+     * The vector versions append the indices and return the number appended.
+     * Throws CStringInvalidArgException if str is empty.
+     */
+    inline size_type findAll(const char ch, size_type *indices, size_type maxIndices, size_type index = 0)      const { return findAll_(&ch, 1, index, indices, maxIndices); };
+    inline size_type findAll(const char *str, size_type *indices, size_type maxIndices, size_type index = 0)    const { return findAll_(str, strlen(str), index, indices, maxIndices); };
+    inline size_type findAll(const CString &str, size_type *indices, size_type maxIndices, size_type index = 0) const { return findAll_(str.str(), str.size(), index, indices, maxIndices); };
+    inline size_type findAll(const char ch, std::vector<size_type> &indices, size_type index = 0)      const { return findAll_(&ch, 1, index, indices); };
+    inline size_type findAll(const char *str, std::vector<size_type> &indices, size_type index = 0)    const { return findAll_(str, strlen(str), index, indices); };
+    inline size_type findAll(const CString &str, std::vector<size_type> &indices, size_type index = 0) const { return findAll_(str.str(), str.size(), index, indices); };
+
+    /**
+     * Return the number of occurrences of the str/char passed in, starting
+     * at index. Occurrences dont overlap, like findAll().
+     */
+    inline size_type count(const char ch, size_type index = 0)      const { return count_(&ch, 1, index); };
+    inline size_type count(const char *str, size_type index = 0)    const { return count_(str, strlen(str), index); };
+    inline size_type count(const CString &str, size_type index = 0) const { return count_(str.str(), str.size(), index); };
+
     /**
      * Return the character at the specified index
      */
@@ -217,9 +511,10 @@ class CString
 
     /**
      * Returns a hash of the string to be used in hash tables, maps, etc
-     * The Hash is recalculated each time this method is called.
+     * Strings with shared data cache the hash, so its only recalculated
+     * after the string is modified. Short inline strings are rehashed each time.
      */
-    unsigned int hash() const;
+    unsigned int hash(HashFunction function = HASH_DEFAULT) const;
 
     /**
      * Return a CString substring starting at index and spanning numChars characters
@@ -227,12 +522,44 @@ class CString
      */
     CString substr(size_type index, size_type numChars = CString::NPOS) const;
 
+    /**
+     * Same as substr(), but the returned CStringView shares the data of
+     * this string instead of copying it. See CStringView.
+     */
+    CStringView substrView(size_type index, size_type numChars = CString::NPOS) const;
+
     /**
      * Return true if the str is the same as this CString, false otherwise
      * Does the same as the operator==
+     * The sizes are compared first, so chars after an embedded '\0' count.
+     * CStrings sharing their data are equal without comparing the chars.
+     */
+    inline bool equals(const char *str)    const { return equals_(str, strlen(str)); };
+    inline bool equals(const char *str, size_type length) const { return equals_(str, length); };
+    bool equals(const CString &str) const;
+
+    /**
+     * Three way compare, returns < 0, 0 or > 0 like strcmp, comparing the
+     * chars as unsigned bytes. A string that is the start of the other
+     * comes first. Embedded '\0's are compared like any other char.
      */
-    inline bool equals(const char *str)    const { return strcmp(data_->str_, str) == 0 ? true : false; };
-    inline bool equals(const CString &str) const { return equals(str.data_->str_); };
+    inline int compare(const char *str)    const { return compare_(str, strlen(str)); };
+    inline int compare(const char *str, size_type length) const { return compare_(str, length); };
+    inline int compare(const CString &str) const { return compare_(str.str(), str.size()); };
+
+    /**
+     * Compare and find ignoring the case of ASCII letters. The chars are
+     * folded as they are compared, neither string is modified or copied.
+     * compareIgnoreCase returns < 0, 0 or > 0 like strcmp, and
+     * findIgnoreCase behaves like find().
+     */
+    inline bool equalsIgnoreCase(const char *str)    const { return compareIgnoreCase_(str, strlen(str)) == 0; };
+    inline bool equalsIgnoreCase(const CString &str) const { return str.size() == size() && compareIgnoreCase_(str.str(), str.size()) == 0; };
+    inline int compareIgnoreCase(const char *str)    const { return compareIgnoreCase_(str, strlen(str)); };
+    inline int compareIgnoreCase(const CString &str) const { return compareIgnoreCase_(str.str(), str.size()); };
+    inline size_type findIgnoreCase(const char ch, size_type index = 0)      const { return findIgnoreCase_(&ch, index, 1); };
+    inline size_type findIgnoreCase(const char *str, size_type index = 0)    const { return findIgnoreCase_(str, index, strlen(str)); };
+    inline size_type findIgnoreCase(const CString &str, size_type index = 0) const { return findIgnoreCase_(str.str(), index, str.size()); };
 
 #ifndef NO_OPERATORS
     // The += operator is the same as calling append
@@ -243,12 +570,27 @@ class CString
     inline size_type operator+=(const char *str)     { return append(str); };
     inline size_type operator+=(const CString &str)  { return append(str); };
 
-    void operator=(const CString &str);
-    inline int operator<(const CString &rhs)      const { return strcmp(str(), rhs.str()); }; // needed for std::map
+    CString &operator=(const CString &str);
+    CString &operator=(CString &&str) noexcept;
     inline bool operator==(const char *str)       const { return equals(str); };
-    inline bool operator==(const CString &str)    const { return equals(str.data_->str_); };
+    inline bool operator==(const CString &str)    const { return equals(str); };
     inline bool operator!=(const char *str)       const { return ! equals(str); };
-    inline bool operator!=(const CString &str)    const { return ! equals(str.data_->str_); };
+    inline bool operator!=(const CString &str)    const { return ! equals(str); };
+    // Ordered by compare(), the less than is what std::map and std::sort need
+    inline bool operator<(const CString &rhs)     const { return compare(rhs) < 0; };
+    inline bool operator<=(const CString &rhs)    const { return compare(rhs) <= 0; };
+    inline bool operator>(const CString &rhs)     const { return compare(rhs) > 0; };
+    inline bool operator>=(const CString &rhs)    const { return compare(rhs) >= 0; };
+    inline bool operator<(const char *rhs)        const { return compare(rhs) < 0; };
+    inline bool operator<=(const char *rhs)       const { return compare(rhs) <= 0; };
+    inline bool operator>(const char *rhs)        const { return compare(rhs) > 0; };
+    inline bool operator>=(const char *rhs)       const { return compare(rhs) >= 0; };
+    friend inline bool operator==(const char *lhs, const CString &rhs) { return rhs.equals(lhs); };
+    friend inline bool operator!=(const char *lhs, const CString &rhs) { return ! rhs.equals(lhs); };
+    friend inline bool operator<(const char *lhs, const CString &rhs)  { return rhs.compare(lhs) > 0; };
+    friend inline bool operator<=(const char *lhs, const CString &rhs) { return rhs.compare(lhs) >= 0; };
+    friend inline bool operator>(const char *lhs, const CString &rhs)  { return rhs.compare(lhs) < 0; };
+    friend inline bool operator>=(const char *lhs, const CString &rhs) { return rhs.compare(lhs) <= 0; };
     inline const char operator[](size_type indeX) const { return index(indeX); };
 #endif
 
@@ -258,33 +600,286 @@ class CString
     //void operator>>()
 
   protected:
-    inline bool checkCapacity(size_type size) const { return (size + data_->size_ > data_->capacity_) ? true : false; };
+    inline bool checkCapacity(size_type size) const { return (size + this->size() > getCapacity()) ? true : false; };
+    inline char *buffer() { return (data_ == NULL) ? small_.str_ : data_->str(); };
+    inline void setSize(size_type size) { if(data_ == NULL) { small_.size_ = size; } else { data_->size_ = size; data_->invalidateHash(); } buffer()[size] = '\0'; };
+    void init(const char *str, size_type length);
+    void makeRoom(size_type size);
+    void detach();
+    void promote();
     void incrementCapacity(size_type size);
+    size_type grownCapacity(size_type size) const;
+    void setCapacity(size_type capacity);
     void decrementReference();
     size_type find_(const char *str, size_type index, size_type length) const;
     size_type rfind_(const char *str, size_type index, size_type length) const;
+    size_type findAll_(const char *str, size_type length, size_type index, size_type *indices, size_type maxIndices) const;
+    size_type findAll_(const char *str, size_type length, size_type index, std::vector<size_type> &indices) const;
+    size_type count_(const char *str, size_type length, size_type index) const;
+    size_type findIgnoreCase_(const char *str, size_type index, size_type length) const;
+    int compareIgnoreCase_(const char *str, size_type length) const;
+    inline bool equals_(const char *str, size_type length) const { return length == size() && memcmp(this->str(), str, length) == 0; };
+    int compare_(const char *str, size_type length) const;
+    void convertCase_(CString &dest, char first) const;
     size_type append_(const char *str, size_type length, size_type minWidth, bool leftJustify);
     size_type insert_(const char *str, size_type index, size_type length, size_type minWidth, bool leftJustify);
-    size_type replace_(const char *str, size_type index, size_type length);
+    size_type replace_(const char *str, size_type strLength, size_type index, size_type length);
+    char *replaceRoom(size_type index, size_type &length, size_type newLength);
+    size_type replaceAll_(const char *str, size_type length, const char *replacement, size_type replacementLength);
     void copy(const CString &copY);
+    void move(CString &movE) noexcept;
 
+    // NULL while the string fits in small_, shared and reference counted otherwise
     CStringData *data_;
+    size_type initialCapacity_;
+    bool autoCapacity_;
     char padChar_;
+    GrowthPolicy growthPolicy_;
+    static GrowthPolicy defaultGrowthPolicy_;
+    CStringArena *arena_; // where data_ is allocated, NULL for the heap
+
+    // Inline storage for short strings, only valid while data_ is NULL.
+    // The capacity is the logical capacity, the same one a CStringData
+    // would have, so promoting to the heap is transparent to the user.
+    struct
+    {
+      size_type capacity_;
+      unsigned char size_;
+      char str_[SMALL_CAPACITY+1];
+    } small_;
 
     friend class CStringBaseIterator;
+    friend class CStringTokenizer;
+    friend class CStringStreamTokenizer;
+    friend class CStringRecordSplitter;
 };
 
+/**
+ * A substring of a CString that shares its data instead of copying it.
+ * The view holds a reference to the data, so it stays valid if the
+ * CString is modified or destroyed, copy on write leaves the view with
+ * the original data. The chars arent null terminated, use data() with size().
+ */
+class CStringView
+{
+  public:
+    typedef CString::size_type size_type;
+
+    CStringView();
+    // Throws like CString::substr()
+    CStringView(const CString &str, size_type index = 0, size_type numChars = CString::NPOS);
 
-// TODO do we want a version that does a copy on write?
+    inline bool empty()            const { return length_ < 1; };
+    inline size_type size()        const { return length_; };
+    inline const char *data()      const { return str_.str() + offset_; };
+    // The index of the view in the CString it was created from
+    inline size_type getOffset()   const { return offset_; };
+
+    /**
+     * Return a CString with the chars of the view. If the view spans the
+     * whole CString it was created from, the data is shared, else its copied.
+     */
+    CString toCString() const;
+
+    // Return a view of part of this view, throws like CString::substr()
+    CStringView substr(size_type index, size_type numChars = CString::NPOS) const;
+
+    // These behave the same as the corresponding CString methods
+    const char index(size_type indeX) const;
+    unsigned int hash(CString::HashFunction function = CString::HASH_DEFAULT) const;
+    CStringIterator iterator() const;
+    CStringReverseIterator riterator() const;
+
+    inline size_type find(const char ch, size_type index = 0)          const { return find_(&ch, index, 1); };
+    inline size_type find(const char *str, size_type index = 0)        const { return find_(str, index, strlen(str)); };
+    inline size_type find(const CString &str, size_type index = 0)     const { return find_(str.str(), index, str.size()); };
+    inline size_type find(const CStringView &str, size_type index = 0) const { return find_(str.data(), index, str.size()); };
+
+    inline size_type rfind(const char ch, size_type index = 0)          const { return rfind_(&ch, index, 1); };
+    inline size_type rfind(const char *str, size_type index = 0)        const { return rfind_(str, index, strlen(str)); };
+    inline size_type rfind(const CString &str, size_type index = 0)     const { return rfind_(str.str(), index, str.size()); };
+    inline size_type rfind(const CStringView &str, size_type index = 0) const { return rfind_(str.data(), index, str.size()); };
+
+    /**
+     * Compare the chars of the view, returning < 0, 0 or > 0 like strcmp
+     */
+    inline int compare(const char *str)        const { return compare_(str, strlen(str)); };
+    inline int compare(const CString &str)     const { return compare_(str.str(), str.size()); };
+    inline int compare(const CStringView &str) const { return compare_(str.data(), str.size()); };
+
+    inline bool equals(const char *str)        const { return compare(str) == 0; };
+    inline bool equals(const CString &str)     const { return str.size() == length_ && compare(str) == 0; };
+    inline bool equals(const CStringView &str) const { return str.size() == length_ && compare(str) == 0; };
+
+    // These behave the same as the corresponding CString methods
+    inline bool equalsIgnoreCase(const char *str)        const { return compareIgnoreCase(str) == 0; };
+    inline bool equalsIgnoreCase(const CString &str)     const { return str.size() == length_ && compareIgnoreCase(str) == 0; };
+    inline bool equalsIgnoreCase(const CStringView &str) const { return str.size() == length_ && compareIgnoreCase(str) == 0; };
+    inline int compareIgnoreCase(const char *str)        const { return compareIgnoreCase_(str, strlen(str)); };
+    inline int compareIgnoreCase(const CString &str)     const { return compareIgnoreCase_(str.str(), str.size()); };
+    inline int compareIgnoreCase(const CStringView &str) const { return compareIgnoreCase_(str.data(), str.size()); };
+    inline size_type findIgnoreCase(const char *str, size_type index = 0)    const { return findIgnoreCase_(str, index, strlen(str)); };
+    inline size_type findIgnoreCase(const CString &str, size_type index = 0) const { return findIgnoreCase_(str.str(), index, str.size()); };
+
+#ifndef NO_OPERATORS
+    inline bool operator==(const char *str)        const { return equals(str); };
+    inline bool operator==(const CString &str)     const { return equals(str); };
+    inline bool operator==(const CStringView &str) const { return equals(str); };
+    inline bool operator!=(const char *str)        const { return ! equals(str); };
+    inline bool operator!=(const CString &str)     const { return ! equals(str); };
+    inline bool operator!=(const CStringView &str) const { return ! equals(str); };
+    inline bool operator<(const CStringView &rhs)  const { return compare(rhs) < 0; };
+    inline const char operator[](size_type indeX)  const { return index(indeX); };
+#endif
+
+  private:
+    size_type find_(const char *str, size_type index, size_type length) const;
+    size_type rfind_(const char *str, size_type index, size_type length) const;
+    int compare_(const char *str, size_type length) const;
+    size_type findIgnoreCase_(const char *str, size_type index, size_type length) const;
+    int compareIgnoreCase_(const char *str, size_type length) const;
+
+    CString str_;  // shares the data
+    size_type offset_;
+    size_type length_;
+
+    friend class CStringBaseIterator;
+    friend class CStringTokenizer;
+    friend class CStringStreamTokenizer;
+};
+
+/**
+ * A needle prepared once for searching many haystacks. The skip tables
+ * are built by the constructor, so each search only scans the haystack.
+ * find and rfind behave like the CString methods, except that a haystack
+ * too short for the needle returns NPOS instead of throwing.
+ * count returns the number of non overlapping occurrences.
+ * The constructors throw CStringInvalidArgException for an empty needle.
+ */
+class CStringSearcher
+{
+  public:
+    typedef CString::size_type size_type;
+
+    CStringSearcher(const char *needle);
+    CStringSearcher(const CString &needle);
+    CStringSearcher(const CStringSearcher &copy);
+    // The moved from CStringSearcher has an empty needle and finds nothing
+    CStringSearcher(CStringSearcher &&movE) noexcept;
+    virtual ~CStringSearcher();
+
+    inline const CString &getNeedle() const { return needle_; };
+
+    inline size_type find(const CString &haystack, size_type index = 0)            const { return find_(haystack.str(), haystack.size(), index); };
+    inline size_type find(const CStringView &haystack, size_type index = 0)        const { return find_(haystack.data(), haystack.size(), index); };
+    inline size_type find(const char *haystack, size_type length, size_type index = 0) const { return find_(haystack, length, index); };
+
+    inline size_type rfind(const CString &haystack, size_type index = 0)            const { return rfind_(haystack.str(), haystack.size(), index); };
+    inline size_type rfind(const CStringView &haystack, size_type index = 0)        const { return rfind_(haystack.data(), haystack.size(), index); };
+    inline size_type rfind(const char *haystack, size_type length, size_type index = 0) const { return rfind_(haystack, length, index); };
+
+    inline size_type count(const CString &haystack)              const { return count_(haystack.str(), haystack.size()); };
+    inline size_type count(const CStringView &haystack)          const { return count_(haystack.data(), haystack.size()); };
+    inline size_type count(const char *haystack, size_type length) const { return count_(haystack, length); };
+
+#ifndef NO_OPERATORS
+    CStringSearcher &operator=(const CStringSearcher &rhs);
+    CStringSearcher &operator=(CStringSearcher &&rhs) noexcept;
+#endif
+
+  private:
+    // this ctor is disallowed
+    CStringSearcher();
+
+    void prepare();
+    size_type find_(const char *haystack, size_type length, size_type index) const;
+    size_type rfind_(const char *haystack, size_type length, size_type index) const;
+    size_type count_(const char *haystack, size_type length) const;
+
+    // The forward and reverse tables, defined in CString.cpp
+    struct SearchTables;
+
+    CString needle_;
+    SearchTables *tables_;
+};
+
+/**
+ * Search for many patterns at once, in a single pass over the haystack
+ * (Aho-Corasick). The patterns are compiled by the constructor into a
+ * DFA over the byte classes used by the patterns, stored in one table
+ * in breadth first order, so the states near the root, which most of
+ * the scan stays in, share cache lines. Each pattern is identified by its
+ * position in the patterns given to the constructor.
+ * The constructors throw CStringInvalidArgException for an empty pattern.
+ */
+class CStringMultiSearcher
+{
+  public:
+    typedef CString::size_type size_type;
+
+    struct Match
+    {
+      size_type pattern_;  // the pattern id
+      size_type index_;    // where the pattern starts in the haystack
+    };
+
+    CStringMultiSearcher(const std::vector<CString> &patterns);
+    CStringMultiSearcher(const char **patterns, size_type numPatterns);
+    virtual ~CStringMultiSearcher();
+
+    inline size_type getNumPatterns()                const { return patterns_.size(); };
+    inline const CString &getPattern(size_type id)   const { return patterns_[id]; };
+    inline size_type getNumStates()                  const { return numStates_; };
+
+    /**
+     * Append all the matches, including overlapping ones, to matches in
+     * the order they end in the haystack, longer patterns first for the
+     * same end. Returns the number of matches appended.
+     */
+    inline size_type findAll(const CString &haystack, std::vector<Match> &matches)     const { return findAll_(haystack.str(), haystack.size(), matches); };
+    inline size_type findAll(const CStringView &haystack, std::vector<Match> &matches) const { return findAll_(haystack.data(), haystack.size(), matches); };
+    inline size_type findAll(const char *haystack, size_type length, std::vector<Match> &matches) const { return findAll_(haystack, length, matches); };
+
+    /**
+     * Stop at the first match, the one that ends first, without collecting
+     * the others. Returns false if no pattern is found.
+     */
+    inline bool findFirst(const CString &haystack, Match &match)     const { return findFirst_(haystack.str(), haystack.size(), match); };
+    inline bool findFirst(const CStringView &haystack, Match &match) const { return findFirst_(haystack.data(), haystack.size(), match); };
+    inline bool findFirst(const char *haystack, size_type length, Match &match) const { return findFirst_(haystack, length, match); };
+
+  private:
+    // this ctor is disallowed
+    CStringMultiSearcher();
+
+    void compile();
+    size_type findAll_(const char *haystack, size_type length, std::vector<Match> &matches) const;
+    bool findFirst_(const char *haystack, size_type length, Match &match) const;
+
+    std::vector<CString> patterns_;
+    // The byte class of each byte, class 0 is the bytes in no pattern
+    unsigned short byteClass_[256];
+    size_type numClasses_;
+    size_type numStates_;
+    // The transitions, numClasses_ per state. Each holds the row offset of
+    // the next state, with OUTPUT_FLAG set if that state has matches.
+    std::vector<size_type> transitions_;
+    // The patterns ending at each state, linked by nextOutput_, and the
+    // next state on the failure chain with outputs
+    std::vector<size_type> firstOutput_;
+    std::vector<size_type> nextOutput_;
+    std::vector<size_type> outputLink_;
+};
 
 /**
  * Tokenize a CString based on any of the chars in the token string.
  * The original CString or char* is not modified. If a CString is
- * passed in for the input string, the tokenizer refers to the same
- * data, so changing the original string in between calls to next()
- * may cause unexpected behaviour. Each call to next() returns a new
+ * passed in for the input string, the tokenizer shares the same
+ * data, changing the original string in between calls to next()
+ * doesnt affect the tokenizer. Each call to next() returns a new
  * CString, when the end of the input string is reached, an empty
- * CString is returned.
+ * CString is returned. The next() overloads that return a bool
+ * dont copy the tokens, they return views or offsets instead.
  */
 class CStringTokenizer
 {
@@ -293,29 +888,201 @@ class CStringTokenizer
     CStringTokenizer(const char *str,     const CString &token);
     CStringTokenizer(const CString &str,  const char *token);
     CStringTokenizer(const CString &str,  const CString &token);
+    CStringTokenizer(CStringTokenizer &&cst) noexcept;
     virtual ~CStringTokenizer();
     CString next();
+
+    /**
+     * Same as next(), but set token to a view of the next token in the
+     * input string instead of copying it, so tokens dont allocate. Call
+     * toCString() on the view to keep a copy. Returns false, leaving token
+     * as it was, when there are no more tokens.
+     */
+    bool next(CStringView &token);
+
+    /**
+     * Same as next(), but set the offset and length of the next token in
+     * input(). Returns false when there are no more tokens.
+     */
+    bool next(CString::size_type &offset, CString::size_type &length);
+
+    // The string being tokenized, which the views and offsets refer to
+    inline const CString &input() const { return inputStr_; };
 #ifndef NO_OPERATORS
     inline CString operator()() { return next(); }; // same as next()
+    CStringTokenizer &operator=(CStringTokenizer &&cst) noexcept;
 #endif
 
+    // The offset and length in the input of a token returned by split()
+    struct Token
+    {
+      CString::size_type offset_;
+      CString::size_type length_;
+    };
+
+    /**
+     * Split str into the tokens next() would return, as their offsets and
+     * lengths in input order, replacing the contents of tokens. Large inputs
+     * are divided into regions scanned by numThreads threads, 0 for one per
+     * core. Each thread returns the tokens starting in its region, scanning
+     * past the region's end to finish its last one, so tokens crossing the
+     * region boundaries are found whole, once.
+     */
+    static void split(const CString &str, const char *token, std::vector<Token> &tokens, unsigned int numThreads = 0);
+    static void split(const CString &str, const CString &token, std::vector<Token> &tokens, unsigned int numThreads = 0);
+
     static const CString whitespace;
+    // split() gives each thread at least this many chars, small inputs use fewer threads
+    static const CString::size_type MIN_SPLIT_REGION;
 
   private:
     // these ctors are disallowed
     CStringTokenizer();
     CStringTokenizer(const CStringTokenizer &cst);
 
+    void prepare();
+    CString::size_type findDelimiter_(const char *ptr, CString::size_type length, bool isDelimiter) const;
+
     CString inputStr_;
     CString token_;
     CString::size_type index_;
+    // Non 0 for the chars in token_, so each input char is checked with 1 lookup
+    unsigned char delimiters_[256];
+};
+
+/**
+ * Tokenize input that is read in chunks, from a file descriptor or a read
+ * function, instead of being in memory all at once. The tokens are the
+ * same ones CStringTokenizer would return for the whole input, including
+ * tokens spanning chunks. Read chunks go into one buffer that is reused,
+ * only growing when a token is longer than it, so memory is bounded by
+ * the chunk size and the longest token, not by the size of the input.
+ * Throws CStringIOException if a read fails.
+ */
+class CStringStreamTokenizer
+{
+  public:
+    static const CString::size_type DEFAULT_CHUNK_SIZE;
+
+    /**
+     * Read up to length chars into buffer and return the number read,
+     * 0 at the end of the input, or < 0 on an error.
+     */
+    typedef std::function<long(char *buffer, CString::size_type length)> ReadFunction;
+
+    // The file descriptor is read until end of file, and isnt closed
+    CStringStreamTokenizer(int fd, const char *token, CString::size_type chunkSize = DEFAULT_CHUNK_SIZE);
+    CStringStreamTokenizer(int fd, const CString &token, CString::size_type chunkSize = DEFAULT_CHUNK_SIZE);
+    CStringStreamTokenizer(const ReadFunction &read, const char *token, CString::size_type chunkSize = DEFAULT_CHUNK_SIZE);
+    CStringStreamTokenizer(const ReadFunction &read, const CString &token, CString::size_type chunkSize = DEFAULT_CHUNK_SIZE);
+    virtual ~CStringStreamTokenizer();
+
+    // These behave like the CStringTokenizer methods, except that at the
+    // end next(CStringView &) empties the view, which shared the buffer
+    CString next();
+    bool next(CStringView &token);
+#ifndef NO_OPERATORS
+    inline CString operator()() { return next(); }; // same as next()
+#endif
+
+    /**
+     * Set token to point to the next token in the buffer, which stays valid
+     * until the next call. Returns false when there are no more tokens.
+     */
+    bool next(const char *&token, CString::size_type &length);
+
+    // The bytes allocated for the buffer, to check the memory used
+    inline CString::size_type getBufferCapacity() const { return buffer_.getCapacity(); };
+
+  private:
+    // these ctors are disallowed
+    CStringStreamTokenizer();
+    CStringStreamTokenizer(const CStringStreamTokenizer &cst);
+
+    void prepare();
+    bool fill();
+    bool next_(CString::size_type &offset, CString::size_type &length);
+    CString::size_type findDelimiter_(CString::size_type index, bool isDelimiter) const;
+
+    ReadFunction read_;
+    CString token_;
+    CString::size_type chunkSize_;
+    // The chars read and not yet tokenized, from index_
+    CString buffer_;
+    CString::size_type index_;
+    bool skipping_; // index_ is at the delimiters after the last token
+    bool eof_;
+    bool done_;
+    unsigned char delimiters_[256];
+};
+
+/**
+ * Split delimiter separated records, such as CSV or TSV, into fields.
+ * Unlike CStringTokenizer, each delimiter separates 2 fields, so empty
+ * fields are kept. A field starting with the quote char runs to the
+ * closing quote, and may contain delimiters and ends of line, with a
+ * doubled quote for the quote char itself. If an escape char is set,
+ * it makes the char after it part of the field, in quoted fields or not.
+ * Records end at "\n" or "\r\n", or at the end of the input.
+ * The fields are returned as offsets into the input, written to an
+ * array the caller reuses, so splitting doesnt copy or allocate.
+ * Throws CStringInvalidArgException for a quote that isnt closed, or
+ * chars between a closing quote and the next delimiter.
+ */
+class CStringRecordSplitter
+{
+  public:
+    // The chars of a field, inside the quotes if its quoted
+    struct Field
+    {
+      CString::size_type offset_;
+      CString::size_type length_;
+      bool quoted_;
+      bool escaped_; // holds doubled quotes or escapes, see unescape()
+    };
+
+    // A quote or escape char of '\0' turns quoting or escaping off. Throws
+    // CStringInvalidArgException for an end of line delimiter or escape.
+    CStringRecordSplitter(char delimiter = ',', char quote = '"', char escape = '\0');
+
+    /**
+     * Split the record starting at index in input, writing up to maxFields
+     * fields, and return the number of fields in the record, which is more
+     * than maxFields if they didnt all fit. index is moved past the record
+     * and its end of line. Returns 0 when index is at the end of the input.
+     */
+    CString::size_type next(const char *input, CString::size_type length, CString::size_type &index,
+                            Field *fields, CString::size_type maxFields) const;
+    // The fields are stored in fields, whose capacity is reused from record to record
+    CString::size_type next(const CString &input, CString::size_type &index, std::vector<Field> &fields) const;
+
+    /**
+     * Set dest to the chars of field in input, with the doubled quotes and
+     * escapes removed. Fields that arent escaped_ are just copied.
+     */
+    void unescape(const char *input, const Field &field, CString &dest) const;
+    inline void unescape(const CString &input, const Field &field, CString &dest) const { unescape(input.str(), field, dest); };
+
+  private:
+    bool nextField_(const char *input, CString::size_type length, CString::size_type &pos, Field &field) const;
+
+    char delimiter_;
+    char quote_;
+    char escape_;
+    // The chars that end or interrupt an unquoted field, and a quoted one
+    char fieldChars_[4];
+    CString::size_type numFieldChars_;
+    char quotedChars_[2];
+    CString::size_type numQuotedChars_;
+    unsigned char fieldTable_[256];
+    unsigned char quotedTable_[256];
 };
 
 class CStringException
 {
 	public:
 		CStringException(char *msg) : msg_(msg) {};
-		inline const CString what() const {return msg_; };
+		inline const CString &what() const {return msg_; };
 
 	private:
     CString msg_;
@@ -335,6 +1102,13 @@ class CStringOutOfBoundsException : public CStringException
 		CStringOutOfBoundsException(char *msg) : CStringException(msg) {};
 };
 
+// This is just a marker exception to help distinguish
+class CStringIOException : public CStringException
+{
+	public:
+		CStringIOException(char *msg) : CStringException(msg) {};
+};
+
 // This is just a marker exception to help distinguish
 class CStringIteratorException : public CStringException
 {
@@ -347,14 +1121,18 @@ class CStringBaseIterator
   public:
     CStringBaseIterator();
     CStringBaseIterator(const CString &str);
+    // Only iterates the chars of the view
+    CStringBaseIterator(const CStringView &view);
     CStringBaseIterator(const CStringBaseIterator &copy);
+    CStringBaseIterator(CStringBaseIterator &&movE) noexcept;
 #ifndef NO_OPERATORS
-    void operator=(const CStringBaseIterator &);
+    CStringBaseIterator &operator=(const CStringBaseIterator &);
+    CStringBaseIterator &operator=(CStringBaseIterator &&) noexcept;
 #endif
 
     virtual ~CStringBaseIterator();
 
-    inline CString::size_type currentIndex() { return index_; };
+    inline CString::size_type currentIndex() { return index_ - begin_; };
     virtual bool hasNext() const = 0;
     virtual const char next() = 0;
     virtual void reset() = 0;
@@ -367,8 +1145,12 @@ class CStringBaseIterator
     // operator>()
 
   protected:
+    void releaseData();
+
     CStringData *data_;
     int index_;
+    int begin_; // the chars iterated are [begin_, end_) of data_
+    int end_;
 };
 
 class CStringIterator : public CStringBaseIterator
@@ -376,7 +1158,14 @@ class CStringIterator : public CStringBaseIterator
   public:
     CStringIterator();
     CStringIterator(const CString &str);
+    CStringIterator(const CStringView &view);
     CStringIterator(const CStringBaseIterator &copy);
+    CStringIterator(const CStringIterator &copy) = default;
+    CStringIterator(CStringIterator &&movE) noexcept = default;
+#ifndef NO_OPERATORS
+    CStringIterator &operator=(const CStringIterator &) = default;
+    CStringIterator &operator=(CStringIterator &&) noexcept = default;
+#endif
 
     ~CStringIterator();
 
@@ -390,7 +1179,14 @@ class CStringReverseIterator : public CStringBaseIterator
   public:
     CStringReverseIterator();
     CStringReverseIterator(const CString &str);
+    CStringReverseIterator(const CStringView &view);
     CStringReverseIterator(const CStringBaseIterator &copy);
+    CStringReverseIterator(const CStringReverseIterator &copy) = default;
+    CStringReverseIterator(CStringReverseIterator &&movE) noexcept = default;
+#ifndef NO_OPERATORS
+    CStringReverseIterator &operator=(const CStringReverseIterator &) = default;
+    CStringReverseIterator &operator=(CStringReverseIterator &&) noexcept = default;
+#endif
 
     ~CStringReverseIterator();
 
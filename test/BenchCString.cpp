@@ -0,0 +1,584 @@
+#include <iostream>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#include <CString.h>
+
+// A very simple benchmark program for the CString class.
+// For meaningful numbers build the library with optimizations:
+//   make clean all CCFLAGS="-O2 -fPIC -pthread" && cd test && make bench
+// Each benchmark prints the throughput of the CString method, and
+// of the straightforward loop it replaced, for comparison.
+
+static const CString::size_type BENCH_SIZE = 16*1024*1024;
+static const int BENCH_ITERATIONS = 20;
+
+// Keeps the compiler from optimizing away the benchmarked calls
+static volatile CString::size_type benchSink;
+
+#define BENCH(name, bytes, code) \
+  { \
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now(); \
+    for(int iter = 0; iter < BENCH_ITERATIONS; iter++) { code; } \
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start; \
+    std::cout << "  " << name << ": " \
+              << ((double) (bytes) * BENCH_ITERATIONS / (1024*1024)) / elapsed.count() \
+              << " MB/s" << std::endl; \
+  }
+
+// The byte at a time loops the CString find methods used to use
+CString::size_type naiveFindChar(const CString &str, char ch)
+{
+  const char *ptr = str.str();
+  for(CString::size_type i = 0; i < str.size(); i++)
+  {
+    if(ptr[i] == ch)
+    {
+      return i;
+    }
+  }
+  return CString::NPOS;
+}
+
+CString::size_type naiveRfindChar(const CString &str, char ch)
+{
+  const char *ptr = str.str();
+  for(CString::size_type i = str.size(); i-- > 0; )
+  {
+    if(ptr[i] == ch)
+    {
+      return i;
+    }
+  }
+  return CString::NPOS;
+}
+
+CString::size_type naiveFindString(const CString &str, const CString &needle)
+{
+  const char *ptr = str.str();
+  if(needle.size() > str.size())
+  {
+    return CString::NPOS;
+  }
+  CString::size_type endpoint = str.size() - needle.size() + 1;
+  for(CString::size_type i = 0; i < endpoint; i++)
+  {
+    if(ptr[i] == needle.str()[0] &&
+       memcmp(ptr+i+1, needle.str()+1, needle.size()-1) == 0)
+    {
+      return i;
+    }
+  }
+  return CString::NPOS;
+}
+
+CString::size_type naiveRfindString(const CString &str, const CString &needle)
+{
+  const char *ptr = str.str();
+  if(needle.size() > str.size())
+  {
+    return CString::NPOS;
+  }
+  for(CString::size_type i = str.size() - needle.size() + 1; i-- > 0; )
+  {
+    if(ptr[i] == needle.str()[0] &&
+       memcmp(ptr+i+1, needle.str()+1, needle.size()-1) == 0)
+    {
+      return i;
+    }
+  }
+  return CString::NPOS;
+}
+
+// A string of BENCH_SIZE chars, cycling through the letters,
+// with the first and last chars specified
+CString makeBenchString(char first, char last)
+{
+  CString str(BENCH_SIZE);
+  str.append(first);
+  for(CString::size_type i = 1; i < BENCH_SIZE-1; i++)
+  {
+    str.append((char) ('a' + (i % 26)));
+  }
+  str.append(last);
+  return str;
+}
+
+void benchFindChar()
+{
+  // The char is only at the far end, so the whole string is scanned
+  CString str = makeBenchString('a', '=');
+  std::cout << "find char, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::find(char)", BENCH_SIZE, benchSink = str.find('='));
+  BENCH("naive loop         ", BENCH_SIZE, benchSink = naiveFindChar(str, '='));
+
+  str = makeBenchString('=', 'a');
+  std::cout << "rfind char, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::rfind(char)", BENCH_SIZE, benchSink = str.rfind('='));
+  BENCH("naive loop          ", BENCH_SIZE, benchSink = naiveRfindChar(str, '='));
+}
+
+void benchFindString()
+{
+  // Needles that start like the text but are never found
+  CString str = makeBenchString('a', 'a');
+  CString shortNeedle("mnopq=");
+  CString longNeedle;
+  for(int i = 0; i < 63; i++)
+  {
+    longNeedle.append((char) ('a' + (i % 26)));
+  }
+  longNeedle.append('=');
+
+  std::cout << "find string, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::find(6 chars)  ", BENCH_SIZE, benchSink = str.find(shortNeedle));
+  BENCH("naive loop              ", BENCH_SIZE, benchSink = naiveFindString(str, shortNeedle));
+  BENCH("CString::find(64 chars) ", BENCH_SIZE, benchSink = str.find(longNeedle));
+  BENCH("naive loop              ", BENCH_SIZE, benchSink = naiveFindString(str, longNeedle));
+  BENCH("CString::rfind(6 chars) ", BENCH_SIZE, benchSink = str.rfind(shortNeedle));
+  BENCH("naive loop              ", BENCH_SIZE, benchSink = naiveRfindString(str, shortNeedle));
+  BENCH("CString::rfind(64 chars)", BENCH_SIZE, benchSink = str.rfind(longNeedle));
+  BENCH("naive loop              ", BENCH_SIZE, benchSink = naiveRfindString(str, longNeedle));
+
+  // Repetitive text, where every position is a partial match
+  CString::size_type worstSize = 1024*1024;
+  CString worst(worstSize);
+  worst.append('a', 0, true, worstSize);
+  CString worstNeedle;
+  worstNeedle.append('a', 0, true, 31);
+  worstNeedle.append('b');
+
+  std::cout << "find string worst case, " << worstSize/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::find(a..ab) ", worstSize, benchSink = worst.find(worstNeedle));
+  BENCH("naive loop           ", worstSize, benchSink = naiveFindString(worst, worstNeedle));
+  BENCH("CString::rfind(a..ab)", worstSize, benchSink = worst.rfind(worstNeedle));
+  BENCH("naive loop           ", worstSize, benchSink = naiveRfindString(worst, worstNeedle));
+
+  worstNeedle.clear();
+  worstNeedle.append('a', 0, true, 127);
+  worstNeedle.append('b');
+  BENCH("CString::find(128 chars a..ab) ", worstSize, benchSink = worst.find(worstNeedle));
+  BENCH("naive loop                     ", worstSize, benchSink = naiveFindString(worst, worstNeedle));
+  BENCH("CString::rfind(128 chars a..ab)", worstSize, benchSink = worst.rfind(worstNeedle));
+  BENCH("naive loop                     ", worstSize, benchSink = naiveRfindString(worst, worstNeedle));
+}
+
+void benchFindAll()
+{
+  // A char every 26 bytes and a 3 char string every 26 bytes
+  CString str = makeBenchString('a', 'a');
+  CString::size_type *indices = new CString::size_type[BENCH_SIZE];
+  std::vector<CString::size_type> indexVector;
+
+  std::cout << "find all, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::findAll(char)  ", BENCH_SIZE, benchSink = str.findAll('q', indices, BENCH_SIZE));
+  BENCH("find(char) loop         ", BENCH_SIZE,
+        CString::size_type n = 0;
+        for(CString::size_type i = str.find('q'); i != CString::NPOS; i = str.find('q', i + 1))
+        {
+          indices[n++] = i;
+        }
+        benchSink = n);
+  BENCH("CString::count(char)    ", BENCH_SIZE, benchSink = str.count('q'));
+  BENCH("CString::findAll(vector)", BENCH_SIZE, indexVector.clear(); benchSink = str.findAll("qrs", indexVector));
+  BENCH("find(str) loop          ", BENCH_SIZE,
+        indexVector.clear();
+        for(CString::size_type i = str.find("qrs"); i != CString::NPOS; i = str.find("qrs", i + 3))
+        {
+          indexVector.push_back(i);
+        }
+        benchSink = indexVector.size());
+  BENCH("CString::count(str)     ", BENCH_SIZE, benchSink = str.count("qrs"));
+
+  delete [] indices;
+}
+
+void benchReplaceAll()
+{
+  // A 3 char string every 26 bytes, a replace() loop is quadratic so keep it small
+  CString::size_type replaceSize = 64*1024;
+  CString str;
+  for(CString::size_type i = 0; i < replaceSize; i++)
+  {
+    str.append((char) ('a' + (i % 26)));
+  }
+
+  std::cout << "replace all, " << replaceSize/1024 << " KB string" << std::endl;
+  BENCH("CString::replaceAll(shorter)", replaceSize,
+        CString work(str.clone()); benchSink = work.replaceAll("qrs", "Q"));
+  BENCH("find and replace loop       ", replaceSize,
+        CString work(str.clone());
+        for(CString::size_type i = work.find("qrs"); i != CString::NPOS; )
+        {
+          work.replace("Q", i, 3);
+          i = (i + 4 <= work.size()) ? work.find("qrs", i + 1) : CString::NPOS;
+        }
+        benchSink = work.size());
+  BENCH("CString::replaceAll(longer) ", replaceSize,
+        CString work(str.clone()); benchSink = work.replaceAll("qrs", "QRSTUV"));
+  BENCH("find and replace loop       ", replaceSize,
+        CString work(str.clone());
+        for(CString::size_type i = work.find("qrs"); i != CString::NPOS; )
+        {
+          work.replace("QRSTUV", i, 3);
+          i = (i + 9 <= work.size()) ? work.find("qrs", i + 6) : CString::NPOS;
+        }
+        benchSink = work.size());
+}
+
+void benchIgnoreCase()
+{
+  // Equal ignoring case, so the whole string is compared
+  CString str = makeBenchString('a', 'a');
+  CString upper(str.clone());
+  upper.toupper();
+
+  std::cout << "ignore case, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::equalsIgnoreCase ", BENCH_SIZE, benchSink = str.equalsIgnoreCase(upper));
+  BENCH("tolower copies and equals ", BENCH_SIZE,
+        CString lower1(str.clone()); CString lower2(upper.clone());
+        lower1.tolower(); lower2.tolower();
+        benchSink = lower1.equals(lower2));
+  BENCH("CString::findIgnoreCase   ", BENCH_SIZE, benchSink = str.findIgnoreCase("MNOPQ="));
+  BENCH("tolower copy and find     ", BENCH_SIZE,
+        CString lower(str.clone()); lower.tolower();
+        benchSink = lower.find("mnopq="));
+}
+
+// The byte loop toupper used to run
+static void naiveToupper(char *ptr, CString::size_type length)
+{
+  for(CString::size_type i = 0; i < length; i++)
+  {
+    if(ptr[i] >= 'a' && ptr[i] <= 'z')
+    {
+      ptr[i] -= 32;
+    }
+  }
+}
+
+void benchCaseConvert()
+{
+  CString str = makeBenchString('a', 'a');
+  CString work(str.clone());
+  CString dest(str.clone());
+  std::vector<char> buffer(str.str(), str.str() + str.size() + 1);
+
+  std::cout << "case conversion, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::toupper          ", BENCH_SIZE, work.toupper());
+  BENCH("byte loop                 ", BENCH_SIZE, naiveToupper(&buffer[0], str.size()); benchSink = buffer[0]);
+  BENCH("CString::toupper(CString) ", BENCH_SIZE, str.toupper(dest));
+  BENCH("clone and toupper         ", BENCH_SIZE, CString copy(str.clone()); copy.toupper());
+}
+
+void benchHash()
+{
+  CString str = makeBenchString('a', 'a');
+  std::cout << "hash, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("HASH_DEFAULT uncached     ", BENCH_SIZE, CString copy(str.str()); benchSink = copy.hash());
+  BENCH("HASH_FAST uncached        ", BENCH_SIZE, CString copy(str.str()); benchSink = copy.hash(CString::HASH_FAST));
+  BENCH("memcpy, the copy alone    ", BENCH_SIZE, CString copy(str.str()); benchSink = copy.size());
+
+  // Map keys: hashed again for every lookup
+  std::vector<CString> keys;
+  CString::size_type totalBytes = 0;
+  for(int i = 0; i < 10000; i++)
+  {
+    CString key("/usr/share/application/resources/key");
+    key.append(i);
+    totalBytes += key.size();
+    keys.push_back(key);
+  }
+  std::cout << "hash 10000 keys of " << keys[0].size() << " chars" << std::endl;
+  BENCH("HASH_DEFAULT cached       ", totalBytes,
+        for(std::vector<CString>::size_type i = 0; i < keys.size(); i++) { benchSink = keys[i].hash(); });
+  BENCH("HASH_FAST cached          ", totalBytes,
+        for(std::vector<CString>::size_type i = 0; i < keys.size(); i++) { benchSink = keys[i].hash(CString::HASH_FAST); });
+  BENCH("HASH_DEFAULT on views     ", totalBytes,
+        for(std::vector<CString>::size_type i = 0; i < keys.size(); i++) { benchSink = keys[i].substrView(1).hash(); });
+  BENCH("HASH_FAST on views        ", totalBytes,
+        for(std::vector<CString>::size_type i = 0; i < keys.size(); i++) { benchSink = keys[i].substrView(1).hash(CString::HASH_FAST); });
+}
+
+void benchCompare()
+{
+  // Equal chars in separate data, so the whole string is compared
+  CString str = makeBenchString('a', 'a');
+  CString copy(str.str());
+  CString shared(str);
+
+  std::cout << "compare, " << BENCH_SIZE/(1024*1024) << " MB string" << std::endl;
+  BENCH("CString::equals           ", BENCH_SIZE, benchSink = str.equals(copy));
+  BENCH("strcmp                    ", BENCH_SIZE, benchSink = strcmp(str.str(), copy.str()));
+  BENCH("CString::compare          ", BENCH_SIZE, benchSink = str.compare(copy));
+  BENCH("CString::equals shared    ", BENCH_SIZE, benchSink = str.equals(shared));
+}
+
+// The char at a time scan CStringTokenizer::next used to do, counting the tokens
+static CString::size_type naiveTokenize(const CString &input, const CString &delimiters)
+{
+  CString::size_type numTokens = 0;
+  CString::size_type index = 0;
+  while(index < input.size())
+  {
+    CString::size_type end = index;
+    while(end < input.size() && delimiters.find(input.index(end)) == CString::NPOS)
+    {
+      end++;
+    }
+    numTokens++;
+    index = end;
+    while(index < input.size() && delimiters.find(input.index(index)) != CString::NPOS)
+    {
+      index++;
+    }
+  }
+
+  return numTokens;
+}
+
+// Words of 1 to 12 letters, each followed by one of the delimiters
+static CString makeBenchText(CString::size_type size, const char *delimiters)
+{
+  CString text(size);
+  CString::size_type numDelimiters = strlen(delimiters);
+  for(CString::size_type i = 0; text.size() < size - 16; i++)
+  {
+    for(CString::size_type j = 0; j <= (i * 7) % 12; j++)
+    {
+      text.append((char) ('a' + ((i + j) % 26)));
+    }
+    text.append(delimiters[i % numDelimiters]);
+  }
+  return text;
+}
+
+void benchTokenizer()
+{
+  const CString::size_type size = 1024*1024;
+  CString text = makeBenchText(size, " \t");
+  std::cout << "tokenize " << size/(1024*1024) << " MB of words" << std::endl;
+  BENCH("CStringTokenizer whitespace", text.size(),
+        CStringTokenizer tokenizer(text, CStringTokenizer::whitespace);
+        while(tokenizer.next().size() > 0) { benchSink++; });
+  BENCH("byte loop whitespace       ", text.size(), benchSink = naiveTokenize(text, CStringTokenizer::whitespace));
+  BENCH("CStringTokenizer views     ", text.size(),
+        CStringTokenizer tokenizer(text, CStringTokenizer::whitespace); CStringView view;
+        while(tokenizer.next(view)) { benchSink++; });
+
+  // Too many delimiters to compare directly, so the table is used
+  const char *punctuation = " \t,;:.!?";
+  CString punctuated = makeBenchText(size, punctuation);
+  BENCH("CStringTokenizer 8 chars   ", punctuated.size(),
+        CStringTokenizer tokenizer(punctuated, punctuation);
+        while(tokenizer.next().size() > 0) { benchSink++; });
+  BENCH("byte loop 8 chars          ", punctuated.size(), benchSink = naiveTokenize(punctuated, punctuation));
+
+  // Long tokens, where the scan matters more than creating the token
+  CString letters = makeBenchString('a', 'a').substr(0, 136);
+  CString lines;
+  for(int i = 0; i < 8192; i++)
+  {
+    lines.append(letters.substr(0, 120 + (i % 16)));
+    lines.append('\n');
+  }
+  std::cout << "tokenize " << lines.size()/(1024*1024) << " MB of 128 char lines" << std::endl;
+  BENCH("CStringTokenizer lines     ", lines.size(),
+        CStringTokenizer tokenizer(lines, "\n");
+        while(tokenizer.next().size() > 0) { benchSink++; });
+  BENCH("CStringTokenizer views     ", lines.size(),
+        CStringTokenizer tokenizer(lines, "\n"); CStringView view;
+        while(tokenizer.next(view)) { benchSink++; });
+  BENCH("byte loop lines            ", lines.size(), benchSink = naiveTokenize(lines, "\n"));
+
+  // The same lines read in 64 KB chunks, from memory and from a file
+  CString::size_type position = 0;
+  CStringStreamTokenizer::ReadFunction reader = [&lines, &position](char *buffer, CString::size_type length) -> long
+  {
+    CString::size_type numRead = (length < lines.size() - position) ? length : lines.size() - position;
+    memcpy(buffer, lines.str() + position, numRead);
+    position += numRead;
+    return (long) numRead;
+  };
+  BENCH("stream from memory, views  ", lines.size(),
+        position = 0; CStringStreamTokenizer stream(reader, "\n"); CStringView view;
+        while(stream.next(view)) { benchSink++; });
+  FILE *file = tmpfile();
+  fwrite(lines.str(), 1, lines.size(), file);
+  fflush(file);
+  BENCH("stream from a file, views  ", lines.size(),
+        lseek(fileno(file), 0, SEEK_SET); CStringStreamTokenizer stream(fileno(file), "\n"); CStringView view;
+        while(stream.next(view)) { benchSink++; });
+  fclose(file);
+}
+
+void benchSplit()
+{
+  CString text = makeBenchText(BENCH_SIZE, " \t");
+  std::vector<CStringTokenizer::Token> tokens;
+  std::cout << "split " << BENCH_SIZE/(1024*1024) << " MB of words, "
+            << std::thread::hardware_concurrency() << " cores" << std::endl;
+  BENCH("CStringTokenizer views     ", text.size(),
+        CStringTokenizer tokenizer(text, CStringTokenizer::whitespace); CStringView view;
+        while(tokenizer.next(view)) { benchSink++; });
+  BENCH("split, 1 thread            ", text.size(), CStringTokenizer::split(text, CStringTokenizer::whitespace, tokens, 1));
+  BENCH("split, 4 threads           ", text.size(), CStringTokenizer::split(text, CStringTokenizer::whitespace, tokens, 4));
+  BENCH("split, 1 thread per core   ", text.size(), CStringTokenizer::split(text, CStringTokenizer::whitespace, tokens));
+}
+
+// A byte at a time CSV field scan, without quoting, counting the fields
+static CString::size_type naiveSplitFields(const CString &input)
+{
+  CString::size_type numFields = 0;
+  const char *ptr = input.str();
+  for(CString::size_type i = 0; i < input.size(); i++)
+  {
+    if(ptr[i] == ',' || ptr[i] == '\n')
+    {
+      numFields++;
+    }
+  }
+
+  return numFields;
+}
+
+void benchRecordSplitter()
+{
+  // Records of 8 fields, 1 in 4 of them quoted in the quoted input
+  CString plain(BENCH_SIZE);
+  CString quoted(BENCH_SIZE);
+  CString letters = makeBenchText(64, "_");
+  for(int i = 0; plain.size() < BENCH_SIZE - 256; i++)
+  {
+    for(int f = 0; f < 8; f++)
+    {
+      CString field = letters.substr((i + f) % 16, 4 + (i + f) % 24);
+      plain.append(field);
+      plain.append((f == 7) ? '\n' : ',');
+      if(f % 4 == 0)
+      {
+        quoted.append('"');
+        quoted.append(field);
+        quoted.append("\",");
+      }
+      else
+      {
+        quoted.append(field);
+        quoted.append((f == 7) ? '\n' : ',');
+      }
+    }
+  }
+
+  CStringRecordSplitter splitter;
+  std::vector<CStringRecordSplitter::Field> fields;
+  std::cout << "split " << plain.size()/(1024*1024) << " MB of CSV records" << std::endl;
+  BENCH("CStringRecordSplitter      ", plain.size(),
+        CString::size_type index = 0; while(splitter.next(plain, index, fields) > 0) { benchSink++; });
+  BENCH("byte loop                  ", plain.size(), benchSink = naiveSplitFields(plain));
+  BENCH("CStringRecordSplitter quoted", quoted.size(),
+        CString::size_type index = 0; while(splitter.next(quoted, index, fields) > 0) { benchSink++; });
+}
+
+void benchSearcher()
+{
+  // Many short haystacks, where preparing the needle costs as much as the scan
+  const int numLines = 100000;
+  std::vector<CString> lines;
+  CString::size_type totalBytes = 0;
+  for(int i = 0; i < numLines; i++)
+  {
+    CString line;
+    for(int j = 0; j < 48 + (i % 40); j++)
+    {
+      line.append((char) ('a' + ((i + j) % 26)));
+    }
+    totalBytes += line.size();
+    lines.push_back(line);
+  }
+
+  CString needle;
+  for(int i = 0; i < 40; i++)
+  {
+    needle.append((char) ('a' + (i % 26)));
+  }
+  needle.append('=');
+  CStringSearcher searcher(needle);
+
+  std::cout << "find 41 chars in " << numLines << " short strings" << std::endl;
+  BENCH("CStringSearcher::find", totalBytes,
+        for(int i = 0; i < numLines; i++) { benchSink = searcher.find(lines[i]); });
+  BENCH("CString::find        ", totalBytes,
+        for(int i = 0; i < numLines; i++) { benchSink = lines[i].find(needle); });
+}
+
+void benchMultiSearcher()
+{
+  // Lines of words, checked against keywords that are mostly not there
+  const int numLines = 20000;
+  const int numKeywords = 200;
+  std::vector<CString> lines;
+  CString::size_type totalBytes = 0;
+  srand(1);
+  for(int i = 0; i < numLines; i++)
+  {
+    CString line;
+    while(line.size() < 80)
+    {
+      for(int j = 3 + rand() % 6; j > 0; j--)
+      {
+        line.append((char) ('a' + rand() % 26));
+      }
+      line.append(' ');
+    }
+    totalBytes += line.size();
+    lines.push_back(line);
+  }
+
+  std::vector<CString> keywords;
+  for(int i = 0; i < numKeywords; i++)
+  {
+    CString keyword;
+    for(int j = 5 + rand() % 6; j > 0; j--)
+    {
+      keyword.append((char) ('a' + rand() % 26));
+    }
+    keywords.push_back(keyword);
+  }
+  CStringMultiSearcher searcher(keywords);
+  std::vector<CStringMultiSearcher::Match> matches;
+
+  std::cout << "find " << numKeywords << " keywords in " << numLines << " lines" << std::endl;
+  BENCH("CStringMultiSearcher::findAll", totalBytes,
+        for(int i = 0; i < numLines; i++) { matches.clear(); benchSink = searcher.findAll(lines[i], matches); });
+  BENCH("CString::find per keyword    ", totalBytes,
+        for(int i = 0; i < numLines; i++)
+        {
+          for(int k = 0; k < numKeywords; k++)
+          {
+            benchSink = lines[i].find(keywords[k]);
+          }
+        });
+}
+
+int main(int argc, char **argv)
+{
+  benchFindChar();
+  benchFindString();
+  benchFindAll();
+  benchReplaceAll();
+  benchIgnoreCase();
+  benchCaseConvert();
+  benchHash();
+  benchCompare();
+  benchTokenizer();
+  benchSplit();
+  benchRecordSplitter();
+  benchSearcher();
+  benchMultiSearcher();
+
+  return 0;
+}
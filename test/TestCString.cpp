@@ -1,5 +1,13 @@
 
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
 
 #include <CString.h>
 
@@ -17,10 +25,10 @@
   std::cerr << "[" << __FILE__ << ":" << __LINE__ << "] " logStr << std::endl;
 
 #define ASSERT_TRUE(boolValue, errorStr) \
-  if( !boolValue ) { std::cerr << "ASSERT_TRUE FAILURE [" << __FILE__ << ":" << __LINE__ << "] " << errorStr << std::endl; }
+  if( !(boolValue) ) { std::cerr << "ASSERT_TRUE FAILURE [" << __FILE__ << ":" << __LINE__ << "] " << errorStr << std::endl; }
 
 #define ASSERT_FALSE(boolValue, errorStr) \
-  if( boolValue ) { std::cerr << "ASSERT_FALSE FAILURE [" << __FILE__ << ":" << __LINE__ << "] " << errorStr << std::endl; }
+  if( (boolValue) ) { std::cerr << "ASSERT_FALSE FAILURE [" << __FILE__ << ":" << __LINE__ << "] " << errorStr << std::endl; }
 
 #define ASSERT_EQUALS(val1, val2, errorStr) \
     if( val1 != val2 ) { \
@@ -57,7 +65,10 @@ class TestCString : public CString
 {
   public:
     TestCString(const CString &copy) : CString(copy) {;}
-    inline int getReferences() const { return data_->references_; };
+    inline int getReferences() const { return data_ == NULL ? 1 : data_->references(); };
+    inline bool isInline() const { return data_ == NULL; };
+    inline CStringArena *getDataArena() const { return data_ == NULL ? NULL : data_->arena_; };
+    inline unsigned int getCachedHash(HashFunction function) const { return data_ == NULL ? 0 : data_->getHash(function); };
 };
 
 // Simple do-nothing method to test passing CStrings by value
@@ -273,6 +284,16 @@ void testInsert()
   str3.insert("not so friendly", 6, 16, false);
   ASSERT_TRUE(str3.equals("Hello not so friendly World"), str3.str());
   ASSERT_EQUALS(str3.size(), 27, "insert size, right pad");
+
+  // insert into the middle of a string larger than the stack
+  const CString::size_type bigSize = 16*1024*1024;
+  CString str4;
+  str4.replace('a', 0, bigSize);
+  str4.insert("xyz", bigSize / 2);
+  CString::size_type bigInsertSize = str4.size();
+  ASSERT_EQUALS(bigInsertSize, bigSize + 3, "insert size, middle of a big string");
+  ASSERT_EQUALS(str4.find("xyz"), bigSize / 2, "insert index, middle of a big string");
+  ASSERT_EQUALS(str4[bigSize + 2], 'a', "insert tail, middle of a big string");
 }
 
 void testFind()
@@ -305,6 +326,99 @@ void testFind()
   ASSERT_EQUALS(str.rfind('e'), 9, "rfind char");
   ASSERT_THROWS(str.rfind("aabbccddee", 10), CStringInvalidArgException, "rfind should throw");
 
+  //
+  // find and rfind char, at every position of strings crossing
+  // the vectorized block sizes
+  //
+  for(int length = 1; length < 100; length++)
+  {
+    for(int pos = 0; pos < length; pos++)
+    {
+      CString str2;
+      str2.append('a', 0, true, length);
+      str2.replace('x', pos, 1, 1);
+      ASSERT_EQUALS(str2.find('x'), pos, "find char at position");
+      ASSERT_EQUALS(str2.rfind('x'), pos, "rfind char at position");
+      ASSERT_EQUALS(str2.find('x', pos), pos, "find char from position");
+      ASSERT_EQUALS(str2.find('y'), CString::NPOS, "find char not found");
+      ASSERT_EQUALS(str2.rfind('y'), CString::NPOS, "rfind char not found");
+      if(pos+1 < length)
+      {
+        ASSERT_EQUALS(str2.find('x', pos+1), CString::NPOS, "find char after position");
+      }
+      if(pos > 0)
+      {
+        ASSERT_EQUALS(str2.rfind('x', length-pos), CString::NPOS, "rfind char before position");
+      }
+    }
+  }
+
+  //
+  // find and rfind substrings against std::string, on random text from
+  // small alphabets so there are many partial matches. Needles longer than
+  // the vectorized filter, and repetitive input that makes the filter fall
+  // back, use Two-Way.
+  //
+  srand(12345);
+  for(int round = 0; round < 400; round++)
+  {
+    int alphabet = 2 + round % 3;
+    int hayLength = 1 + rand() % 300;
+    std::string hay;
+    for(int i = 0; i < hayLength; i++)
+    {
+      hay += (char) ('a' + rand() % alphabet);
+    }
+
+    int needleLength = 2 + rand() % ((round % 4 == 0) ? 80 : 12);
+    std::string needle;
+    if(needleLength <= hayLength && rand() % 2)
+    {
+      needle = hay.substr(rand() % (hayLength - needleLength + 1), needleLength);
+    }
+    else
+    {
+      for(int i = 0; i < needleLength; i++)
+      {
+        needle += (char) ('a' + rand() % alphabet);
+      }
+    }
+
+    CString str2(hay.c_str());
+    for(int index = 0; index + needleLength <= hayLength; index += 1 + rand() % 7)
+    {
+      std::string::size_type found = hay.find(needle, index);
+      CString::size_type expected = (found == std::string::npos) ? CString::NPOS : found;
+      ASSERT_EQUALS(str2.find(needle.c_str(), index), expected,
+                    "find random substring " << needle << " in " << hay << " from " << index);
+
+      found = hay.rfind(needle, hayLength - index - needleLength);
+      expected = (found == std::string::npos) ? CString::NPOS : found;
+      ASSERT_EQUALS(str2.rfind(needle.c_str(), index), expected,
+                    "rfind random substring " << needle << " in " << hay << " from " << index);
+    }
+  }
+
+  // Worst case input for a first/last char filter, periodic needles
+  for(int needleLength = 2; needleLength < 100; needleLength += 7)
+  {
+    CString hay;
+    hay.append('a', 0, true, 5000);
+    CString needle;
+    needle.append('a', 0, true, needleLength - 1);
+    CString bNeedle(needle);
+    bNeedle.append("b");
+    ASSERT_EQUALS(hay.find(bNeedle), CString::NPOS, "find periodic needle not found");
+    ASSERT_EQUALS(hay.rfind(bNeedle), CString::NPOS, "rfind periodic needle not found");
+
+    CString hayB(hay);
+    hayB.append("b");
+    hayB.append(hay);
+    ASSERT_EQUALS(hayB.find(bNeedle), 5000 - needleLength + 1, "find periodic needle");
+    ASSERT_EQUALS(hayB.rfind(bNeedle), 5000 - needleLength + 1, "rfind periodic needle");
+    ASSERT_EQUALS(hayB.find(needle, 4000), 4000, "find periodic run");
+    ASSERT_EQUALS(hayB.rfind(needle), 10001 - needleLength + 1, "rfind periodic run");
+  }
 }
 
 void testReplace()
@@ -351,11 +465,321 @@ void testReplace()
   ASSERT_EQUALS(str.size(), 6, "replace empty Cstring");
 }
 
+void testFindAll()
+{
+  CString str("aabbccddeeaabbccddee");
+  CString::size_type indices[8];
+
+  ASSERT_EQUALS(str.findAll('b', indices, 8), 4, "findAll char");
+  ASSERT_EQUALS(indices[0], 2, "findAll char 0");
+  ASSERT_EQUALS(indices[3], 13, "findAll char 3");
+  ASSERT_EQUALS(str.findAll('b', indices, 8, 3), 3, "findAll char from index");
+  ASSERT_EQUALS(indices[0], 3, "findAll char from index 0");
+  ASSERT_EQUALS(str.findAll('b', indices, 2), 2, "findAll char full buffer");
+  ASSERT_EQUALS(indices[1], 3, "findAll char full buffer 1");
+  ASSERT_EQUALS(str.findAll("bcc", indices, 8), 2, "findAll str");
+  ASSERT_EQUALS(indices[0], 3, "findAll str 0");
+  ASSERT_EQUALS(indices[1], 13, "findAll str 1");
+  ASSERT_EQUALS(str.findAll(CString("x"), indices, 8), 0, "findAll not found");
+  ASSERT_EQUALS(str.findAll("aabbccddeeaabbccddeeaa", indices, 8), 0, "findAll str too long");
+
+  // Occurrences dont overlap
+  CString aaa("aaaaa");
+  ASSERT_EQUALS(aaa.findAll("aa", indices, 8), 2, "findAll no overlap");
+  ASSERT_EQUALS(indices[1], 2, "findAll no overlap 1");
+  ASSERT_EQUALS(aaa.count("aa"), 2, "count no overlap");
+
+  std::vector<CString::size_type> indexVector;
+  ASSERT_EQUALS(str.findAll("dd", indexVector), 2, "findAll vector");
+  ASSERT_EQUALS(str.findAll('e', indexVector, 10), 2, "findAll vector appends");
+  ASSERT_EQUALS(indexVector.size(), 4, "findAll vector size");
+  ASSERT_EQUALS(indexVector[1], 16, "findAll vector 1");
+  ASSERT_EQUALS(indexVector[3], 19, "findAll vector 3");
+
+  ASSERT_EQUALS(str.count('a'), 4, "count char");
+  ASSERT_EQUALS(str.count('a', 1), 3, "count char from index");
+  ASSERT_EQUALS(str.count("ccdd"), 2, "count str");
+  ASSERT_EQUALS(str.count(CString("ccdd"), 5), 1, "count CString from index");
+  ASSERT_EQUALS(CString().count('a'), 0, "count empty");
+
+  ASSERT_THROWS(str.findAll("", indices, 8), CStringInvalidArgException, "findAll empty str");
+  ASSERT_THROWS(str.count(""), CStringInvalidArgException, "count empty str");
+  ASSERT_THROWS(str.count('a', 21), CStringOutOfBoundsException, "count index > size");
+
+  // The same as a find() loop, for chars past the vector blocks, short and long needles
+  CString big;
+  for(int i = 0; i < 5000; i++)
+  {
+    big.append((char) ('a' + (i * 7) % 5));
+  }
+  const char *needles[] = {"c", "ac", "cbea", "aceb", "acebdacebdacebdacebdacebdacebdacebdaceb"};
+  for(int n = 0; n < 5; n++)
+  {
+    std::vector<CString::size_type> expected;
+    CString::size_type needleLength = strlen(needles[n]);
+    for(CString::size_type pos = big.find(needles[n]); pos != CString::NPOS; )
+    {
+      expected.push_back(pos);
+      pos = (pos + needleLength + needleLength <= big.size()) ? big.find(needles[n], pos + needleLength) : CString::NPOS;
+    }
+
+    std::vector<CString::size_type> found;
+    ASSERT_EQUALS(big.findAll(needles[n], found), expected.size(), "findAll loop " << needles[n]);
+    ASSERT_TRUE(found == expected, "findAll loop indices " << needles[n]);
+    ASSERT_EQUALS(big.count(needles[n]), expected.size(), "count loop " << needles[n]);
+  }
+
+  // Repetitive input where the vector filter gives up part way through
+  CString repetitive;
+  for(int i = 0; i < 300; i++)
+  {
+    repetitive.append('a', 0, true, 30);
+    repetitive.append('b');
+  }
+  std::vector<CString::size_type> found;
+  ASSERT_EQUALS(repetitive.findAll("aba", found), 299, "findAll repetitive");
+  ASSERT_EQUALS(found[0], 29, "findAll repetitive 0");
+  ASSERT_EQUALS(found[298], 298*31 + 29, "findAll repetitive 298");
+  ASSERT_EQUALS(repetitive.count("aba"), 299, "count repetitive");
+}
+
+void testSearcher()
+{
+  CString str("aabbccddeeaabbccddee");
+  CStringSearcher searcher("ccdd");
+  ASSERT_TRUE(searcher.getNeedle().equals("ccdd"), "searcher needle");
+  ASSERT_EQUALS(searcher.find(str), 4, "searcher find");
+  ASSERT_EQUALS(searcher.find(str, 5), 14, "searcher find from index");
+  ASSERT_EQUALS(searcher.find(str, 15), CString::NPOS, "searcher find not found");
+  ASSERT_EQUALS(searcher.rfind(str), 14, "searcher rfind");
+  ASSERT_EQUALS(searcher.rfind(str, 3), 4, "searcher rfind from index");
+  ASSERT_EQUALS(searcher.count(str), 2, "searcher count");
+  ASSERT_EQUALS(searcher.find("xxccdd", 6), 2, "searcher find char buffer");
+  ASSERT_EQUALS(searcher.find(str.substrView(6)), 8, "searcher find view");
+  ASSERT_EQUALS(searcher.count(str.substrView(6)), 1, "searcher count view");
+
+  // Short haystacks dont throw, unlike CString::find
+  ASSERT_EQUALS(searcher.find(CString("ccd")), CString::NPOS, "searcher find short haystack");
+  ASSERT_EQUALS(searcher.rfind(CString("cc")), CString::NPOS, "searcher rfind short haystack");
+  ASSERT_EQUALS(searcher.count(CString("")), 0, "searcher count empty haystack");
+  ASSERT_THROWS(searcher.find(str, 21), CStringOutOfBoundsException, "searcher find index > size");
+  ASSERT_THROWS(CStringSearcher(""), CStringInvalidArgException, "searcher empty needle");
+
+  // Non overlapping occurrences
+  CStringSearcher aa("aa");
+  ASSERT_EQUALS(aa.count(CString("aaaaa")), 2, "searcher count non overlapping");
+  CStringSearcher a("a");
+  ASSERT_EQUALS(a.count(str), 4, "searcher count char");
+  ASSERT_EQUALS(a.rfind(str), 11, "searcher rfind char");
+
+  // Copies and moves keep the tables
+  CStringSearcher copy(searcher);
+  ASSERT_EQUALS(copy.rfind(str), 14, "searcher copy");
+  CStringSearcher moved(std::move(copy));
+  ASSERT_EQUALS(moved.find(str), 4, "searcher move");
+  ASSERT_EQUALS(copy.find(str), CString::NPOS, "moved from searcher finds nothing");
+  copy = aa;
+  ASSERT_EQUALS(copy.find(str), 0, "searcher assign");
+
+  // The same results as CString::find and rfind, for long needles too
+  srand(54321);
+  for(int round = 0; round < 200; round++)
+  {
+    CString hay;
+    int hayLength = 1 + rand() % 400;
+    for(int i = 0; i < hayLength; i++)
+    {
+      hay.append((char) ('a' + rand() % 3));
+    }
+    int needleLength = 1 + rand() % ((round % 2 == 0) ? 60 : 8);
+    CString needle;
+    for(int i = 0; i < needleLength; i++)
+    {
+      needle.append((char) ('a' + rand() % 3));
+    }
+
+    CStringSearcher randomSearcher(needle);
+    for(int index = 0; index + needleLength <= hayLength; index += 1 + rand() % 9)
+    {
+      ASSERT_EQUALS(randomSearcher.find(hay, index), hay.find(needle, index), "searcher random find");
+      ASSERT_EQUALS(randomSearcher.rfind(hay, index), hay.rfind(needle, index), "searcher random rfind");
+    }
+  }
+}
+
+void testMultiSearcher()
+{
+  const char *patterns[] = {"he", "she", "his", "hers"};
+  CStringMultiSearcher searcher(patterns, 4);
+  ASSERT_EQUALS(searcher.getNumPatterns(), 4, "multi searcher patterns");
+  ASSERT_TRUE(searcher.getPattern(3).equals("hers"), "multi searcher pattern");
+
+  std::vector<CStringMultiSearcher::Match> matches;
+  ASSERT_EQUALS(searcher.findAll(CString("ushers"), matches), 3, "multi searcher findAll");
+  ASSERT_EQUALS(matches.size(), 3, "multi searcher findAll size");
+  ASSERT_EQUALS(matches[0].pattern_, 1, "multi searcher she");
+  ASSERT_EQUALS(matches[0].index_, 1, "multi searcher she index");
+  ASSERT_EQUALS(matches[1].pattern_, 0, "multi searcher he");
+  ASSERT_EQUALS(matches[1].index_, 2, "multi searcher he index");
+  ASSERT_EQUALS(matches[2].pattern_, 3, "multi searcher hers");
+  ASSERT_EQUALS(matches[2].index_, 2, "multi searcher hers index");
+
+  // Matches are appended
+  ASSERT_EQUALS(searcher.findAll("this", 4, matches), 1, "multi searcher findAll char buffer");
+  ASSERT_EQUALS(matches.size(), 4, "multi searcher findAll appends");
+  ASSERT_EQUALS(matches[3].pattern_, 2, "multi searcher his");
+
+  CStringMultiSearcher::Match match;
+  ASSERT_TRUE(searcher.findFirst(CString("ushers"), match), "multi searcher findFirst");
+  ASSERT_EQUALS(match.pattern_, 1, "multi searcher findFirst pattern");
+  ASSERT_EQUALS(match.index_, 1, "multi searcher findFirst index");
+  ASSERT_FALSE(searcher.findFirst(CString("xyz"), match), "multi searcher findFirst not found");
+  ASSERT_TRUE(searcher.findFirst(CString("ushers").substrView(2), match), "multi searcher findFirst view");
+  ASSERT_EQUALS(match.pattern_, 0, "multi searcher findFirst view pattern");
+  ASSERT_EQUALS(match.index_, 0, "multi searcher findFirst view index");
+
+  const char *emptyPatterns[] = {"a", ""};
+  ASSERT_THROWS(CStringMultiSearcher(emptyPatterns, 2), CStringInvalidArgException, "multi searcher empty pattern");
+
+  // Compare with every pattern found at every position, in the findAll order:
+  // by end position, then longest first, then by pattern id
+  srand(777);
+  for(int round = 0; round < 100; round++)
+  {
+    int alphabet = 2 + round % 4;
+    std::vector<CString> randomPatterns;
+    int numPatterns = 1 + rand() % 30;
+    for(int p = 0; p < numPatterns; p++)
+    {
+      CString pattern;
+      int patternLength = 1 + rand() % 6;
+      for(int i = 0; i < patternLength; i++)
+      {
+        pattern.append((char) ('a' + rand() % alphabet));
+      }
+      randomPatterns.push_back(pattern);
+    }
+    CStringMultiSearcher randomSearcher(randomPatterns);
+
+    CString hay;
+    int hayLength = rand() % 200;
+    for(int i = 0; i < hayLength; i++)
+    {
+      hay.append((char) ('a' + rand() % alphabet));
+    }
+
+    std::vector<CStringMultiSearcher::Match> expected;
+    for(int end = 0; end < hayLength; end++)
+    {
+      for(int patternLength = 6; patternLength > 0; patternLength--)
+      {
+        for(int p = 0; p < numPatterns; p++)
+        {
+          int start = end + 1 - patternLength;
+          if(randomPatterns[p].size() == (CString::size_type) patternLength && start >= 0 &&
+             memcmp(hay.str() + start, randomPatterns[p].str(), patternLength) == 0)
+          {
+            CStringMultiSearcher::Match m = { (CString::size_type) p, (CString::size_type) start };
+            expected.push_back(m);
+          }
+        }
+      }
+    }
+
+    std::vector<CStringMultiSearcher::Match> found;
+    ASSERT_EQUALS(randomSearcher.findAll(hay, found), expected.size(), "multi searcher random count");
+    for(size_t i = 0; i < found.size() && i < expected.size(); i++)
+    {
+      ASSERT_EQUALS(found[i].pattern_, expected[i].pattern_, "multi searcher random pattern");
+      ASSERT_EQUALS(found[i].index_, expected[i].index_, "multi searcher random index");
+    }
+
+    ASSERT_EQUALS(randomSearcher.findFirst(hay, match), ! expected.empty(), "multi searcher random findFirst");
+    if(! expected.empty())
+    {
+      ASSERT_EQUALS(match.pattern_, expected[0].pattern_, "multi searcher random findFirst pattern");
+      ASSERT_EQUALS(match.index_, expected[0].index_, "multi searcher random findFirst index");
+    }
+  }
+}
+
 void testSubstr()
 {
   // TODO finish this
 }
 
+void testSubstrView()
+{
+  CString str("key1=value1;key2=value2");
+  TestCString tstr(str);
+
+  // Views share the data
+  CStringView view = str.substrView(5, 6);
+  ASSERT_EQUALS(tstr.getReferences(), 3, "view should share the data");
+  ASSERT_EQUALS(view.size(), 6, "view size");
+  ASSERT_EQUALS(view.getOffset(), 5, "view offset");
+  ASSERT_TRUE(view.equals("value1"), "view equals char*");
+  ASSERT_TRUE(view.equals(CString("value1")), "view equals CString");
+  ASSERT_FALSE(view.equals("value"), "view equals shorter char*");
+  ASSERT_FALSE(view.equals("value12"), "view equals longer char*");
+  ASSERT_TRUE(view.compare("value2") < 0, "view compare less");
+  ASSERT_TRUE(view.compare("value") > 0, "view compare longer");
+  ASSERT_EQUALS(view.hash(), CString("value1").hash(), "view hash");
+  ASSERT_EQUALS(view.index(0), 'v', "view index");
+  ASSERT_THROWS(view.index(7), CStringOutOfBoundsException, "view index out of bounds");
+
+  // find and rfind only search within the view
+  ASSERT_EQUALS(view.find('1'), 5, "view find char");
+  ASSERT_EQUALS(view.find("key"), CString::NPOS, "view find past the end");
+  ASSERT_EQUALS(view.rfind("va"), 0, "view rfind");
+  ASSERT_EQUALS(view.rfind("e1;"), CString::NPOS, "view rfind past the end");
+  ASSERT_THROWS(view.find("value12"), CStringInvalidArgException, "view find too long");
+
+  // Views of views
+  CStringView all = str.substrView(0);
+  CStringView key2 = all.substr(12, 4);
+  ASSERT_TRUE(key2.equals("key2"), "view of view");
+  ASSERT_EQUALS(key2.getOffset(), 12, "view of view offset");
+  ASSERT_THROWS(key2.substr(2, 3), CStringOutOfBoundsException, "view substr out of bounds");
+
+  // Iterating a view
+  CStringIterator iter = view.iterator();
+  CString iterated;
+  while(iter.hasNext())
+  {
+    iterated.append(iter.next());
+  }
+  ASSERT_TRUE(iterated.equals("value1"), iterated.str());
+
+  CStringReverseIterator riter = view.riterator();
+  iterated.clear();
+  while(riter.hasNext())
+  {
+    iterated.append(riter.next());
+  }
+  ASSERT_TRUE(iterated.equals("1eulav"), iterated.str());
+
+  // Materializing
+  CString value = view.toCString();
+  ASSERT_TRUE(value.equals("value1"), value.str());
+  TestCString whole(all.toCString());
+  ASSERT_EQUALS(whole.getReferences(), tstr.getReferences(), "view of the whole string should share the data");
+
+  // Modifying the string doesnt affect the views
+  str.replace("VALUE1", 5);
+  ASSERT_TRUE(view.equals("value1"), "view after the string changed");
+
+  // Views of inline strings
+  CString shortStr("a=b");
+  CStringView shortView = shortStr.substrView(2);
+  ASSERT_TRUE(shortView.equals("b"), "view of inline string");
+
+  ASSERT_THROWS_STR(str.substrView(str.size()+1),
+                    CStringOutOfBoundsException,
+                    "CStringView index > size",
+                    "no substrView exception thrown");
+}
+
 void testUpperLowerCase()
 {
   CString str("0123456789abcdefghijklmnopqrstuvwxyz");
@@ -365,6 +789,314 @@ void testUpperLowerCase()
 
   str.tolower();
   ASSERT_TRUE(str.equals("0123456789abcdefghijklmnopqrstuvwxyz"), str.str());
+
+  // Only ASCII letters change, not the chars around them or high bytes
+  CString edges("@AZ[`az{\xC0\xE0\xFF");
+  edges.toupper();
+  ASSERT_TRUE(edges.equals("@AZ[`AZ{\xC0\xE0\xFF"), "toupper edges");
+  edges.tolower();
+  ASSERT_TRUE(edges.equals("@az[`az{\xC0\xE0\xFF"), "tolower edges");
+
+  // Long enough for the vector loops and their tails, against a byte loop
+  CString mixed;
+  for(int i = 0; i < 301; i++)
+  {
+    mixed.append((char) (1 + (i * 37 + 11) % 255));
+  }
+  std::string original(mixed.str());
+  std::string expectUpper(original);
+  std::string expectLower(original);
+  for(std::string::size_type i = 0; i < original.size(); i++)
+  {
+    if(expectUpper[i] >= 'a' && expectUpper[i] <= 'z') { expectUpper[i] -= 32; }
+    if(expectLower[i] >= 'A' && expectLower[i] <= 'Z') { expectLower[i] += 32; }
+  }
+
+  // Copy on write: converting a shared string doesnt change the other one
+  CString upper(mixed);
+  upper.toupper();
+  ASSERT_TRUE(upper.equals(expectUpper.c_str()), "toupper long");
+  ASSERT_TRUE(mixed.equals(original.c_str()), "toupper detaches");
+
+  // Out of place, into a CString, reusing its capacity
+  CString dest("previous contents");
+  mixed.tolower(dest);
+  ASSERT_TRUE(dest.equals(expectLower.c_str()), "tolower into CString");
+  mixed.toupper(dest);
+  ASSERT_TRUE(dest.equals(expectUpper.c_str()), "toupper into CString");
+  ASSERT_TRUE(mixed.equals(original.c_str()), "toupper into CString doesnt modify");
+
+  CString small("Hello");
+  small.toupper(dest);
+  ASSERT_TRUE(dest.equals("HELLO"), "toupper into CString shrinks");
+  small.tolower(small);
+  ASSERT_TRUE(small.equals("hello"), "tolower into itself");
+
+  // A dest sharing its data gets its own copy
+  mixed.tolower(dest);
+  CString alias(dest);
+  mixed.toupper(dest);
+  ASSERT_TRUE(alias.equals(expectLower.c_str()), "toupper into shared dest");
+  ASSERT_TRUE(dest.equals(expectUpper.c_str()), "toupper into shared dest converted");
+
+  // Out of place, into a char buffer
+  std::vector<char> buffer(mixed.size() + 1, 'x');
+  mixed.toupper(&buffer[0]);
+  ASSERT_TRUE(expectUpper == &buffer[0], "toupper into buffer");
+  mixed.tolower(&buffer[0]);
+  ASSERT_TRUE(expectLower == &buffer[0], "tolower into buffer");
+}
+
+void testHash()
+{
+  // The default hash keeps its values
+  CString hello("Hello");
+  ASSERT_EQUALS(hello.hash(), 69609650, "hash value");
+  ASSERT_EQUALS(CString().hash(), 0, "empty hash");
+
+  // Equal strings hash the same however theyre stored
+  CString str("the quick brown fox jumps over the lazy dog");
+  CString copy(str.str());
+  CStringArena arena;
+  CString inArena(arena, str.str());
+  CString::HashFunction functions[] = { CString::HASH_DEFAULT, CString::HASH_FAST };
+  for(int i = 0; i < 2; i++)
+  {
+    unsigned int hash = str.hash(functions[i]);
+    ASSERT_EQUALS(str.hash(functions[i]), hash, "hash repeated");
+    ASSERT_EQUALS(copy.hash(functions[i]), hash, "hash of a copy");
+    ASSERT_EQUALS(inArena.hash(functions[i]), hash, "hash in an arena");
+    ASSERT_EQUALS(str.substrView(0).hash(functions[i]), hash, "hash of a view");
+    unsigned int viewHash = str.substrView(4, 5).hash(functions[i]);
+    unsigned int quickHash = CString("quick").hash(functions[i]);
+    ASSERT_EQUALS(viewHash, quickHash, "hash of part of a view");
+  }
+
+  // The hash is cached in the shared data, and shared with the copies
+  TestCString tstr(str);
+  unsigned int fastHash = str.hash(CString::HASH_FAST);
+  ASSERT_EQUALS(tstr.getCachedHash(CString::HASH_FAST), fastHash, "fast hash cached");
+  ASSERT_EQUALS(tstr.getCachedHash(CString::HASH_DEFAULT), str.hash(), "default hash cached");
+  ASSERT_NOT_EQUALS(fastHash, str.hash(), "hash functions differ");
+
+  // Every mutator drops the cached hash
+  std::vector<CString> mutated;
+  for(int i = 0; i < 11; i++)
+  {
+    CString work(str.str());
+    work.hash();
+    work.hash(CString::HASH_FAST);
+    switch(i)
+    {
+      case 0: work.append("!"); break;
+      case 1: work.insert("!", 3); break;
+      case 2: work.replace("X", 4); break;
+      case 3: work.remove(0, 4); break;
+      case 4: work.toupper(); break;
+      case 5: work.tolower(); work.toupper(); work.tolower(); break;
+      case 6: work.clear(); break;
+      case 7: work.replaceAll('o', '0'); break;
+      case 8: work.replaceAll("the", "a"); break;
+      case 9: work.replaceAll("o", "ooo"); break;
+      case 10: CString("abc").toupper(work); break;
+    }
+    mutated.push_back(work);
+  }
+  for(std::vector<CString>::size_type i = 0; i < mutated.size(); i++)
+  {
+    CString fresh(mutated[i].str());
+    unsigned int hash = mutated[i].hash();
+    unsigned int freshHash = fresh.hash();
+    ASSERT_EQUALS(hash, freshHash, mutated[i].str());
+    hash = mutated[i].hash(CString::HASH_FAST);
+    freshHash = fresh.hash(CString::HASH_FAST);
+    ASSERT_EQUALS(hash, freshHash, mutated[i].str());
+  }
+
+  // Modifying a copy doesnt change the hash of the original
+  CString shared(str);
+  shared.append("!");
+  ASSERT_EQUALS(str.hash(CString::HASH_FAST), fastHash, "copy on write hash");
+  ASSERT_NOT_EQUALS(shared.hash(CString::HASH_FAST), fastHash, "modified copy hash");
+
+  // The fast hash spreads similar keys over the low and high bits, and
+  // every length takes a different path through it
+  const int numKeys = 4096;
+  int lowBuckets[256] = {0};
+  int highBuckets[256] = {0};
+  for(int i = 0; i < numKeys; i++)
+  {
+    CString key("key");
+    key.append(i);
+    for(int j = 0; j < i % 70; j++)
+    {
+      key.append('x');
+    }
+    unsigned int hash = key.hash(CString::HASH_FAST);
+    lowBuckets[hash & 0xff]++;
+    highBuckets[hash >> 24]++;
+  }
+  int maxLow = 0;
+  int maxHigh = 0;
+  for(int i = 0; i < 256; i++)
+  {
+    maxLow = (lowBuckets[i] > maxLow) ? lowBuckets[i] : maxLow;
+    maxHigh = (highBuckets[i] > maxHigh) ? highBuckets[i] : maxHigh;
+  }
+  ASSERT_TRUE(maxLow < 40, "fast hash low bits distribution");
+  ASSERT_TRUE(maxHigh < 40, "fast hash high bits distribution");
+}
+
+void testCompare()
+{
+  CString abc("abc");
+  ASSERT_TRUE(abc.equals("abc"), "equals");
+  ASSERT_FALSE(abc.equals("abcd"), "equals longer");
+  ASSERT_FALSE(abc.equals("ab"), "equals shorter");
+  ASSERT_TRUE(abc.equals(CString("abc")), "equals CString");
+  ASSERT_TRUE(CString().equals(""), "equals empty");
+
+  ASSERT_EQUALS(abc.compare("abc"), 0, "compare");
+  ASSERT_TRUE(abc.compare("abd") < 0, "compare less");
+  ASSERT_TRUE(abc.compare("abb") > 0, "compare greater");
+  ASSERT_TRUE(abc.compare("abcd") < 0, "compare prefix first");
+  ASSERT_TRUE(abc.compare("ab") > 0, "compare prefix after");
+  ASSERT_TRUE(abc.compare(CString("b")) < 0, "compare CString");
+
+  // Chars compare as unsigned bytes, like strcmp
+  ASSERT_TRUE(CString("\xE0").compare("a") > 0, "compare high byte");
+
+  // Embedded end of lines are compared like any other char
+  CString embedded("ab\0cd", 5u, 16u);
+  ASSERT_FALSE(embedded.equals("ab"), "equals embedded nul");
+  ASSERT_TRUE(embedded.equals("ab\0cd", 5), "equals with length");
+  ASSERT_FALSE(embedded.equals(CString("ab\0ce", 5u, 16u)), "equals after embedded nul");
+  ASSERT_TRUE(embedded.compare("ab") > 0, "compare embedded nul");
+  ASSERT_TRUE(embedded.compare(CString("ab\0ce", 5u, 16u)) < 0, "compare after embedded nul");
+
+  // Shared data is equal without comparing, and copies of it compare by size
+  CString longStr("a string too long to be stored inline");
+  CString shared(longStr);
+  ASSERT_TRUE(shared.equals(longStr), "equals shared");
+  ASSERT_EQUALS(shared.compare(longStr), 0, "compare shared");
+  ASSERT_TRUE(longStr.compare(longStr.str(), 8) > 0, "compare same chars shorter");
+
+  // Different cached hashes dont need a compare, equal ones still do
+  CString other("a string too long to be stored inlinE");
+  longStr.hash();
+  other.hash();
+  ASSERT_FALSE(longStr.equals(other), "equals different cached hashes");
+  CString same(longStr.str());
+  same.hash();
+  ASSERT_TRUE(longStr.equals(same), "equals same cached hashes");
+
+#ifndef NO_OPERATORS
+  ASSERT_TRUE(abc == "abc", "operator== char*");
+  ASSERT_TRUE("abc" == abc, "operator== char* first");
+  ASSERT_TRUE(abc != "abd", "operator!= char*");
+  ASSERT_TRUE("abd" != abc, "operator!= char* first");
+  ASSERT_TRUE(abc == CString("abc"), "operator== CString");
+  ASSERT_TRUE(abc != CString("abcd"), "operator!= CString");
+
+  CString abd("abd");
+  ASSERT_TRUE(abc < abd, "operator<");
+  ASSERT_FALSE(abd < abc, "operator< false");
+  ASSERT_FALSE(abc < abc, "operator< equal");
+  ASSERT_TRUE(abc <= abc, "operator<=");
+  ASSERT_TRUE(abd > abc, "operator>");
+  ASSERT_TRUE(abd >= abc, "operator>=");
+  ASSERT_TRUE(abc < "abd", "operator< char*");
+  ASSERT_TRUE(abc >= "abc", "operator>= char*");
+  ASSERT_TRUE("abb" < abc, "operator< char* first");
+  ASSERT_TRUE("abd" > abc, "operator> char* first");
+  ASSERT_TRUE("abc" <= abc, "operator<= char* first");
+  ASSERT_FALSE("abc" > abc, "operator> char* first equal");
+
+  // A strict weak ordering, so CStrings work as std::map keys
+  std::map<CString, int> map;
+  map[CString("pear")] = 1;
+  map[CString("apple")] = 2;
+  map[CString("fig")] = 3;
+  map[CString("apple")] = 4;
+  ASSERT_EQUALS(map.size(), 3, "map size");
+  ASSERT_TRUE(map.begin()->first == "apple", "map order");
+  ASSERT_EQUALS(map[CString("apple")], 4, "map lookup");
+  ASSERT_EQUALS(map.rbegin()->second, 1, "map last");
+#endif
+}
+
+void testIgnoreCase()
+{
+  CString str("Content-Type: Text/HTML");
+  TestCString tstr(str);
+  ASSERT_TRUE(str.equalsIgnoreCase("content-type: text/html"), "equalsIgnoreCase");
+  ASSERT_TRUE(str.equalsIgnoreCase(CString("CONTENT-TYPE: TEXT/HTML")), "equalsIgnoreCase CString");
+  ASSERT_FALSE(str.equalsIgnoreCase("content-type: text/htm"), "equalsIgnoreCase shorter");
+  ASSERT_FALSE(str.equalsIgnoreCase("content-type: text/htmlx"), "equalsIgnoreCase longer");
+  ASSERT_TRUE(str.equals("Content-Type: Text/HTML"), "IgnoreCase doesnt modify");
+  ASSERT_EQUALS(tstr.getReferences(), 2, "IgnoreCase doesnt copy");
+
+  ASSERT_EQUALS(str.compareIgnoreCase("CONTENT-TYPE: TEXT/HTML"), 0, "compareIgnoreCase");
+  ASSERT_TRUE(str.compareIgnoreCase("content-type: text/plain") < 0, "compareIgnoreCase less");
+  ASSERT_TRUE(str.compareIgnoreCase("CONTENT-LENGTH") > 0, "compareIgnoreCase greater");
+  ASSERT_TRUE(str.compareIgnoreCase("content-type") > 0, "compareIgnoreCase prefix");
+  ASSERT_TRUE(CString("abc").compareIgnoreCase("ABCD") < 0, "compareIgnoreCase shorter");
+
+  // Only ASCII letters fold, not the chars around them
+  ASSERT_FALSE(CString("@[`{").equalsIgnoreCase("`{@["), "equalsIgnoreCase around letters");
+  ASSERT_FALSE(CString("\xC0").equalsIgnoreCase("\xE0"), "equalsIgnoreCase high bytes");
+  ASSERT_TRUE(CString("\xC0z").equalsIgnoreCase("\xC0Z"), "equalsIgnoreCase high bytes equal");
+
+  ASSERT_EQUALS(str.findIgnoreCase("TEXT"), 14, "findIgnoreCase");
+  ASSERT_EQUALS(str.findIgnoreCase("html", 5), 19, "findIgnoreCase from index");
+  ASSERT_EQUALS(str.findIgnoreCase('t'), 3, "findIgnoreCase char");
+  ASSERT_EQUALS(str.findIgnoreCase('T', 4), 6, "findIgnoreCase char from index");
+  ASSERT_EQUALS(str.findIgnoreCase(':'), 12, "findIgnoreCase char not a letter");
+  ASSERT_EQUALS(str.findIgnoreCase("xml"), CString::NPOS, "findIgnoreCase not found");
+  ASSERT_THROWS(str.findIgnoreCase("html", 21), CStringInvalidArgException, "findIgnoreCase too long");
+
+  CStringView view = str.substrView(14);
+  ASSERT_TRUE(view.equalsIgnoreCase("text/html"), "view equalsIgnoreCase");
+  ASSERT_TRUE(view.compareIgnoreCase(CString("TEXT/PLAIN")) < 0, "view compareIgnoreCase");
+  ASSERT_EQUALS(view.findIgnoreCase("HTML"), 5, "view findIgnoreCase");
+
+  // Against folding copies, for lengths crossing the vector blocks
+  srand(4242);
+  for(int round = 0; round < 300; round++)
+  {
+    int length = rand() % 150;
+    CString hay;
+    CString lowerHay;
+    for(int i = 0; i < length; i++)
+    {
+      char ch = "aAbB@[`{zZ"[rand() % 10];
+      hay.append(ch);
+      lowerHay.append((char) ((ch >= 'A' && ch <= 'Z') ? ch + 32 : ch));
+    }
+
+    CString other(hay);
+    if(length > 0 && round % 2)
+    {
+      other.replace((char) ((hay.index(length / 2) == 'a') ? 'b' : 'a'), length / 2, 1, 1);
+    }
+    CString lowerOther(other.clone());
+    lowerOther.tolower();
+    int expected = strcmp(lowerHay.str(), lowerOther.str());
+    int result = hay.compareIgnoreCase(other);
+    ASSERT_TRUE((expected < 0) == (result < 0) && (expected > 0) == (result > 0),
+                "compareIgnoreCase random " << hay.str() << " " << other.str());
+
+    int needleLength = 1 + rand() % 40;
+    if(needleLength <= length)
+    {
+      CString needle(lowerHay.substr(rand() % (length - needleLength + 1), needleLength));
+      needle.toupper();
+      CString lowerNeedle(needle);
+      lowerNeedle.tolower();
+      ASSERT_EQUALS(hay.findIgnoreCase(needle), lowerHay.find(lowerNeedle),
+                    "findIgnoreCase random " << needle.str() << " in " << hay.str());
+    }
+  }
 }
 
 void testIsNumber()
@@ -406,6 +1138,70 @@ void testIsNumber()
   ASSERT_FALSE(str.isNumber(), "isNumber: negative case");
 }
 
+void testReplaceAll()
+{
+  CString str("a.b.c.d");
+  ASSERT_EQUALS(str.replaceAll('.', '/'), 3, "replaceAll char");
+  ASSERT_TRUE(str.equals("a/b/c/d"), str.str());
+  ASSERT_EQUALS(str.replaceAll('x', '/'), 0, "replaceAll char not found");
+  ASSERT_EQUALS(str.replaceAll('/', '/'), 3, "replaceAll char same");
+
+  // Shorter replacements are done in place
+  str = "one, two, three, four, five, six, seven";
+  TestCString tstr(str);
+  CString copy(str);
+  ASSERT_EQUALS(str.replaceAll(", ", ","), 6, "replaceAll shorter");
+  ASSERT_TRUE(str.equals("one,two,three,four,five,six,seven"), str.str());
+  ASSERT_TRUE(copy.equals("one, two, three, four, five, six, seven"), "replaceAll shared copy unchanged");
+  ASSERT_EQUALS(str.replaceAll(",", ""), 6, "replaceAll remove");
+  ASSERT_TRUE(str.equals("onetwothreefourfivesixseven"), str.str());
+  ASSERT_EQUALS(str.replaceAll("seven", "7"), 1, "replaceAll at end");
+  ASSERT_TRUE(str.equals("onetwothreefourfivesix7"), str.str());
+
+  // Longer replacements rebuild the string
+  ASSERT_EQUALS(str.replaceAll("e", "EEE"), 4, "replaceAll longer");
+  ASSERT_TRUE(str.equals("onEEEtwothrEEEEEEfourfivEEEsix7"), str.str());
+  ASSERT_EQUALS(str.size(), 31, "replaceAll longer size");
+  ASSERT_EQUALS(str.replaceAll(CString("EEE"), CString("e")), 4, "replaceAll CString");
+  ASSERT_TRUE(str.equals("onetwothreefourfivesix7"), str.str());
+
+  // Non overlapping, left to right
+  CString aaa("aaaaa");
+  ASSERT_EQUALS(aaa.replaceAll("aa", "b"), 2, "replaceAll no overlap");
+  ASSERT_TRUE(aaa.equals("bba"), aaa.str());
+  ASSERT_EQUALS(aaa.replaceAll("x", "y"), 0, "replaceAll not found");
+  ASSERT_TRUE(aaa.equals("bba"), aaa.str());
+
+  // Inline strings, staying inline and growing out of it
+  CString small("abab");
+  ASSERT_EQUALS(small.replaceAll("b", "cd"), 2, "replaceAll small");
+  ASSERT_TRUE(small.equals("acdacd"), small.str());
+  ASSERT_EQUALS(small.replaceAll("cd", "0123456789"), 2, "replaceAll small grows");
+  ASSERT_TRUE(small.equals("a0123456789a0123456789"), small.str());
+
+  // The needle or replacement may be the string itself
+  CString self("abc");
+  ASSERT_EQUALS(self.replaceAll(self, self.str() + 1), 1, "replaceAll self");
+  ASSERT_TRUE(self.equals("bc"), self.str());
+
+  CString fixed("x-x", 4, false);
+  ASSERT_THROWS(fixed.replaceAll("x", "yyy"), CStringOutOfBoundsException, "replaceAll past fixed capacity");
+  ASSERT_THROWS(fixed.replaceAll("", "y"), CStringInvalidArgException, "replaceAll empty str");
+
+  // Large strings, which used to be copied through the stack
+  CString big;
+  for(int i = 0; i < 100000; i++)
+  {
+    big.append("ab,");
+  }
+  ASSERT_EQUALS(big.replaceAll(",", ";;"), 100000, "replaceAll big");
+  ASSERT_EQUALS(big.size(), 400000, "replaceAll big size");
+  ASSERT_EQUALS(big.find(','), CString::NPOS, "replaceAll big none left");
+  ASSERT_EQUALS(big.replace("xyz", 10, 2), 2, "replace big");
+  ASSERT_EQUALS(big.size(), 400001, "replace big size");
+  ASSERT_EQUALS(big.find("xyz"), 10, "replace big find");
+}
+
 void testRemove()
 {
   CString str("1234567890");
@@ -547,6 +1343,455 @@ void testTokenizer()
   CStringTokenizer token2(str, "x");
   token2.next();
   token2.next();
+
+  // A leading delimiter gives an empty first token, trailing ones dont
+  CStringTokenizer leading(",a,,b,,", ",");
+  tokenStr = leading.next();
+  ASSERT_EQUALS(tokenStr.size(), 0, "leading delimiter token");
+  tokenStr = leading.next();
+  ASSERT_TRUE(tokenStr.equals("a"), tokenStr.str());
+  tokenStr = leading.next();
+  ASSERT_TRUE(tokenStr.equals("b"), tokenStr.str());
+  tokenStr = leading.next();
+  ASSERT_EQUALS(tokenStr.size(), 0, "trailing delimiters end");
+
+  // Long input for the vector loops and their tails, with a small delimiter
+  // set and with one too large to compare directly, against a byte loop
+  CString input;
+  for(int i = 0; i < 2000; i++)
+  {
+    int r = (i * 7919) % 97;
+    input.append((char) ((r < 12) ? " \t,;:|!?.-\xA0\xFF"[r] : 'a' + (r % 26)));
+  }
+  const char *delimiterSets[] = { " ", " \t", " \t,;", " \t,;:|!?.-\xA0\xFF" };
+  for(int set = 0; set < 4; set++)
+  {
+    const char *delimiters = delimiterSets[set];
+    CStringTokenizer tokenizer(input, delimiters);
+    std::string::size_type index = 0;
+    std::string expected(input.str());
+    int numTokens = 0;
+    bool done = false;
+    while(!done)
+    {
+      std::string::size_type end = expected.find_first_of(delimiters, index);
+      std::string expectedToken = expected.substr(index, (end == std::string::npos) ? std::string::npos : end - index);
+      tokenStr = tokenizer.next();
+      ASSERT_TRUE(expectedToken == tokenStr.str(), tokenStr.str());
+      numTokens++;
+      index = (end == std::string::npos) ? std::string::npos : expected.find_first_not_of(delimiters, end);
+      done = (index == std::string::npos);
+    }
+    tokenStr = tokenizer.next();
+    ASSERT_EQUALS(tokenStr.size(), 0, "long input end");
+    ASSERT_TRUE(numTokens > 10, "long input tokens");
+  }
+
+  // The delimiters move with the tokenizer
+  CStringTokenizer moved(std::move(leading = CStringTokenizer("x;y z", CString(";"))));
+  tokenStr = moved.next();
+  ASSERT_TRUE(tokenStr.equals("x"), tokenStr.str());
+  tokenStr = moved.next();
+  ASSERT_TRUE(tokenStr.equals("y z"), tokenStr.str());
+
+  // No delimiters at all returns the whole string
+  CStringTokenizer none("a b", "");
+  tokenStr = none.next();
+  ASSERT_TRUE(tokenStr.equals("a b"), tokenStr.str());
+  tokenStr = none.next();
+  ASSERT_EQUALS(tokenStr.size(), 0, "no delimiters end");
+
+  // Views share the input instead of copying each token
+  CString lines("first line of the input\nsecond line of the input\n\nthird\n");
+  CStringTokenizer viewTokenizer(lines, "\n");
+  CStringView view;
+  ASSERT_TRUE(viewTokenizer.next(view), "next view");
+  ASSERT_TRUE(view.equals("first line of the input"), "first view");
+  ASSERT_EQUALS(view.getOffset(), 0, "first view offset");
+  ASSERT_TRUE(view.data() == lines.str(), "view shares the input");
+  ASSERT_TRUE(viewTokenizer.next(view), "next view 2");
+  ASSERT_TRUE(view.equals("second line of the input"), "second view");
+  ASSERT_EQUALS(view.getOffset(), 24, "second view offset");
+  ASSERT_TRUE(view.data() == lines.str() + 24, "second view shares the input");
+  CString kept = view.toCString();
+  ASSERT_TRUE(viewTokenizer.next(view), "next view 3");
+  ASSERT_TRUE(view.equals("third"), "third view");
+  ASSERT_FALSE(viewTokenizer.next(view), "no more views");
+  ASSERT_TRUE(view.equals("third"), "view unchanged at the end");
+  ASSERT_TRUE(kept.equals("second line of the input"), "kept token");
+
+  // Views and copies return the same tokens, including empty ones
+  CString csv(",alpha,,beta,gamma,");
+  CStringTokenizer copies(csv, ",");
+  CStringTokenizer views(csv, ",");
+  CStringTokenizer offsets(csv, ",");
+  CString::size_type offset;
+  CString::size_type length;
+  int numTokens = 0;
+  while(views.next(view))
+  {
+    tokenStr = copies.next();
+    ASSERT_TRUE(view.equals(tokenStr), tokenStr.str());
+    ASSERT_TRUE(offsets.next(offset, length), "next offsets");
+    ASSERT_EQUALS(offset, view.getOffset(), "token offset");
+    ASSERT_EQUALS(length, view.size(), "token length");
+    numTokens++;
+  }
+  ASSERT_EQUALS(numTokens, 4, "view tokens");
+  ASSERT_FALSE(offsets.next(offset, length), "no more offsets");
+  tokenStr = copies.next();
+  ASSERT_EQUALS(tokenStr.size(), 0, "no more copies");
+
+  // A view from a tokenizer over a short inline input keeps its own copy
+  CStringView shortView;
+  {
+    CStringTokenizer shortTokenizer("a b", " ");
+    ASSERT_TRUE(shortTokenizer.next(shortView), "short next view");
+    ASSERT_TRUE(shortTokenizer.next(shortView), "short next view 2");
+  }
+  ASSERT_TRUE(shortView.equals("b"), "short view outlives the tokenizer");
+
+  // Changing the original string doesnt change the views
+  CStringTokenizer original(lines, "\n");
+  ASSERT_TRUE(original.next(view), "next view of original");
+  lines.replace("F", 0);
+  ASSERT_TRUE(view.equals("first line of the input"), "view after changing the original");
+  ASSERT_TRUE(original.input().equals("first line of the input\nsecond line of the input\n\nthird\n"), "input");
+}
+
+// Compare the tokens split() returns to the ones from next(CStringView &)
+void checkSplit(const CString &input, const char *delimiters, unsigned int numThreads, const char *msg)
+{
+  std::vector<CStringTokenizer::Token> tokens;
+  CStringTokenizer::split(input, delimiters, tokens, numThreads);
+
+  CStringTokenizer tokenizer(input, delimiters);
+  CStringView view;
+  std::vector<CStringTokenizer::Token>::size_type numTokens = 0;
+  bool same = true;
+  while(tokenizer.next(view))
+  {
+    same = same && numTokens < tokens.size() &&
+           tokens[numTokens].offset_ == view.getOffset() &&
+           tokens[numTokens].length_ == view.size();
+    numTokens++;
+  }
+  ASSERT_TRUE(same, msg);
+  ASSERT_EQUALS(tokens.size(), numTokens, msg);
+}
+
+void testSplit()
+{
+  // Small inputs are split by 1 thread, whatever is asked for
+  checkSplit(CString(""), " ", 4, "split empty");
+  checkSplit(CString(" "), " ", 4, "split only a delimiter");
+  checkSplit(CString(",a,,b,"), ",", 4, "split leading delimiter");
+  checkSplit(CString("a b  c"), " ", 0, "split small");
+  checkSplit(CString("abc"), "", 2, "split no delimiters");
+
+  std::vector<CStringTokenizer::Token> tokens;
+  CStringTokenizer::split(CString("one two  three"), CStringTokenizer::whitespace, tokens);
+  ASSERT_EQUALS(tokens.size(), 3, "split tokens");
+  ASSERT_EQUALS(tokens[2].offset_, 9, "split offset");
+  ASSERT_EQUALS(tokens[2].length_, 5, "split length");
+
+  // Large enough for several regions: short tokens, runs of delimiters
+  // and a token longer than a region, so the boundaries fall everywhere
+  CString input(4*1024*1024);
+  input.append(' ');
+  for(int i = 0; input.size() < 3*CStringTokenizer::MIN_SPLIT_REGION; i++)
+  {
+    int r = (int) ((i * 7919LL) % 101);
+    input.append((char) ((r < 20) ? " \t,;\n"[r % 5] : 'a' + (r % 26)));
+  }
+  for(CString::size_type i = 0; i < CStringTokenizer::MIN_SPLIT_REGION + 1000; i++)
+  {
+    input.append('x');
+  }
+  for(int i = 0; input.size() < 6*CStringTokenizer::MIN_SPLIT_REGION + 17; i++)
+  {
+    input.append((char) ((i % 9 < 3) ? ' ' : 'y'));
+  }
+
+  unsigned int threadCounts[] = { 1, 2, 3, 4, 5, 7, 16, 0 };
+  for(int t = 0; t < 8; t++)
+  {
+    checkSplit(input, " \t,;\n", threadCounts[t], "split regions");
+    checkSplit(input, " ", threadCounts[t], "split regions 1 delimiter");
+    checkSplit(input, "abcdefg \t", threadCounts[t], "split regions many delimiters");
+  }
+
+  // 0 threads is a thread per core, at least 1 even if the count is unknown
+  std::vector<CStringTokenizer::Token> oneThread;
+  CStringTokenizer::split(input, " \t,;\n", oneThread, 1);
+  CStringTokenizer::split(input, " \t,;\n", tokens, 0);
+  bool sameTokens = (tokens.size() == oneThread.size());
+  for(CString::size_type i = 0; sameTokens && i < tokens.size(); i++)
+  {
+    sameTokens = tokens[i].offset_ == oneThread[i].offset_ && tokens[i].length_ == oneThread[i].length_;
+  }
+  ASSERT_TRUE(input.size() > CStringTokenizer::MIN_SPLIT_REGION, "split 0 threads input size");
+  ASSERT_TRUE(sameTokens, "split 0 threads");
+
+  // Without the leading delimiter, and replacing what tokens held
+  CString noLeading(input.str() + 2);
+  checkSplit(noLeading, " \t,;\n", 4, "split no leading delimiter");
+  CStringTokenizer::split(noLeading, " \t,;\n", tokens, 4);
+  ASSERT_EQUALS(tokens[0].offset_, 0, "split first token");
+  ASSERT_TRUE(tokens[0].length_ > 0, "split first token length");
+}
+
+// The unescaped value of field
+CString fieldValue(const CStringRecordSplitter &splitter, const CString &input, const CStringRecordSplitter::Field &field)
+{
+  CString value;
+  splitter.unescape(input, field, value);
+  return value;
+}
+
+void testRecordSplitter()
+{
+  CStringRecordSplitter csv;
+  std::vector<CStringRecordSplitter::Field> fields;
+  CString::size_type index = 0;
+
+  // Empty fields are kept, between delimiters and at the ends
+  CString simple("a,bb,,d\n,\n\nlast,");
+  ASSERT_EQUALS(csv.next(simple, index, fields), 4, "simple fields");
+  ASSERT_TRUE(fieldValue(csv, simple, fields[0]).equals("a"), "simple field 0");
+  ASSERT_TRUE(fieldValue(csv, simple, fields[1]).equals("bb"), "simple field 1");
+  ASSERT_EQUALS(fields[1].offset_, 2, "simple field offset");
+  ASSERT_EQUALS(fields[2].length_, 0, "simple empty field");
+  ASSERT_TRUE(fieldValue(csv, simple, fields[3]).equals("d"), "simple field 3");
+  ASSERT_EQUALS(index, 8, "index after the record");
+  ASSERT_EQUALS(csv.next(simple, index, fields), 2, "only a delimiter");
+  ASSERT_EQUALS(csv.next(simple, index, fields), 1, "empty line");
+  ASSERT_EQUALS(fields[0].length_, 0, "empty line field");
+  ASSERT_EQUALS(csv.next(simple, index, fields), 2, "last record");
+  ASSERT_EQUALS(fields[1].length_, 0, "trailing delimiter field");
+  ASSERT_EQUALS(csv.next(simple, index, fields), 0, "end of input");
+
+  // Quoted fields with delimiters, ends of line and doubled quotes, and "\r\n"
+  CString quoted("\"x,y\",\"line1\nline2\",\"say \"\"hi\"\"\",\"\",pl\"ain\r\nnext,\"row\"");
+  index = 0;
+  ASSERT_EQUALS(csv.next(quoted, index, fields), 5, "quoted fields");
+  ASSERT_TRUE(fields[0].quoted_, "quoted");
+  ASSERT_FALSE(fields[0].escaped_, "quoted not escaped");
+  ASSERT_TRUE(fieldValue(csv, quoted, fields[0]).equals("x,y"), "quoted delimiter");
+  ASSERT_TRUE(fieldValue(csv, quoted, fields[1]).equals("line1\nline2"), "quoted end of line");
+  ASSERT_TRUE(fields[2].escaped_, "doubled quotes escaped");
+  ASSERT_TRUE(fieldValue(csv, quoted, fields[2]).equals("say \"hi\""), "doubled quotes");
+  ASSERT_EQUALS(fields[3].length_, 0, "quoted empty");
+  ASSERT_FALSE(fields[4].quoted_, "quote inside a field");
+  ASSERT_TRUE(fieldValue(csv, quoted, fields[4]).equals("pl\"ain"), "quote inside a field is kept");
+  ASSERT_EQUALS(csv.next(quoted, index, fields), 2, "record after \\r\\n");
+  ASSERT_TRUE(fieldValue(csv, quoted, fields[0]).equals("next"), "next record");
+  ASSERT_TRUE(fieldValue(csv, quoted, fields[1]).equals("row"), "quoted last field");
+  ASSERT_EQUALS(csv.next(quoted, index, fields), 0, "quoted end of input");
+
+  // TSV with an escape char and no quoting
+  CStringRecordSplitter tsv('\t', '\0', '\\');
+  CString escaped("a\\\tb\t\"q\"\tc\\\\\tend\\\n\n");
+  index = 0;
+  ASSERT_EQUALS(tsv.next(escaped, index, fields), 4, "escaped fields");
+  ASSERT_TRUE(fieldValue(tsv, escaped, fields[0]).equals("a\tb"), "escaped delimiter");
+  ASSERT_TRUE(fieldValue(tsv, escaped, fields[1]).equals("\"q\""), "quotes not special");
+  ASSERT_TRUE(fieldValue(tsv, escaped, fields[2]).equals("c\\"), "escaped escape");
+  ASSERT_TRUE(fieldValue(tsv, escaped, fields[3]).equals("end\n"), "escaped end of line");
+  ASSERT_EQUALS(index, escaped.size(), "escaped index");
+
+  // The caller's array, with more fields than fit
+  CStringRecordSplitter::Field array[2];
+  CString wide("1,2,3,4\n5");
+  index = 0;
+  ASSERT_EQUALS(csv.next(wide.str(), wide.size(), index, array, 2), 4, "more fields than fit");
+  ASSERT_EQUALS(array[1].offset_, 2, "fields that fit");
+  ASSERT_EQUALS(index, 8, "index after a record that didnt fit");
+
+  // The vector keeps its capacity, and grows for a wider record
+  std::vector<CStringRecordSplitter::Field> reused;
+  reused.reserve(3);
+  index = 0;
+  ASSERT_EQUALS(csv.next(wide, index, reused), 4, "vector grows");
+  ASSERT_EQUALS(reused.size(), 4, "vector size");
+  ASSERT_TRUE(fieldValue(csv, wide, reused[3]).equals("4"), "vector last field");
+  const CStringRecordSplitter::Field *data = reused.data();
+  ASSERT_EQUALS(csv.next(wide, index, reused), 1, "vector reused");
+  ASSERT_TRUE(reused.data() == data, "vector not reallocated");
+  ASSERT_EQUALS(reused.size(), 1, "vector size follows the record");
+  CString alternating("1,2\n3,4,5\n6");
+  index = 0;
+  ASSERT_EQUALS(csv.next(alternating, index, reused), 2, "narrower record");
+  ASSERT_EQUALS(csv.next(alternating, index, reused), 3, "wider record within the capacity");
+  ASSERT_TRUE(reused.data() == data, "vector not reallocated for a wider record");
+  ASSERT_TRUE(fieldValue(csv, alternating, reused[2]).equals("5"), "wider record last field");
+  ASSERT_EQUALS(csv.next(alternating, index, reused), 1, "last record");
+  ASSERT_EQUALS(csv.next(alternating, index, reused), 0, "vector end of input");
+  ASSERT_EQUALS(reused.size(), 0, "vector empty at the end of input");
+
+  // Long unquoted records, for the vector loops, against a byte loop
+  CString records;
+  for(int i = 0; i < 3000; i++)
+  {
+    int r = (int) ((i * 7919LL) % 53);
+    records.append((char) ((r < 6) ? ",,,\n\r,"[r] : 'a' + (r % 26)));
+  }
+  index = 0;
+  CString::size_type start = 0;
+  CString::size_type numRecords = 0;
+  bool same = true;
+  while(csv.next(records, index, fields) > 0)
+  {
+    CString::size_type fieldStart = start;
+    for(CString::size_type f = 0; f < fields.size(); f++)
+    {
+      CString::size_type end = fieldStart;
+      while(end < records.size() && records.str()[end] != ',' && records.str()[end] != '\n' &&
+            !(records.str()[end] == '\r' && records.str()[end + 1] == '\n'))
+      {
+        end++;
+      }
+      same = same && fields[f].offset_ == fieldStart && fields[f].length_ == end - fieldStart;
+      fieldStart = end + ((end < records.size() && records.str()[end] == '\r') ? 2 : 1);
+    }
+    start = index;
+    numRecords++;
+  }
+  ASSERT_TRUE(same, "long records fields");
+  ASSERT_TRUE(numRecords > 10, "long records");
+
+  // Bad input and arguments
+  CString unclosed("a,\"bc\nd");
+  index = 0;
+  ASSERT_THROWS(csv.next(unclosed, index, fields), CStringInvalidArgException, "quote not closed");
+  CString afterQuote("\"a\"b,c");
+  index = 0;
+  ASSERT_THROWS(csv.next(afterQuote, index, fields), CStringInvalidArgException, "chars after a closing quote");
+  ASSERT_THROWS(CStringRecordSplitter(',', ','), CStringInvalidArgException, "quote is the delimiter");
+  ASSERT_THROWS(CStringRecordSplitter('\n'), CStringInvalidArgException, "end of line delimiter");
+  ASSERT_THROWS(CStringRecordSplitter(',', '"', '\n'), CStringInvalidArgException, "end of line escape");
+  ASSERT_THROWS(CStringRecordSplitter('\t', '\0', '\r'), CStringInvalidArgException, "carriage return escape");
+}
+
+// Read the chars of input, at most maxRead at a time
+CStringStreamTokenizer::ReadFunction makeReader(const std::string &input, std::string::size_type &position, CString::size_type maxRead)
+{
+  return [&input, &position, maxRead](char *buffer, CString::size_type length) -> long
+  {
+    std::string::size_type numRead = input.copy(buffer, (length < maxRead) ? length : maxRead, position);
+    position += numRead;
+    return (long) numRead;
+  };
+}
+
+void testStreamTokenizer()
+{
+  // The same tokens as CStringTokenizer over the whole input, whatever
+  // the chunks, with tokens and runs of delimiters spanning them
+  std::string input(",leading, and  trailing,,  delimiters ,");
+  for(int i = 0; i < 300; i++)
+  {
+    input.append((i % 7 == 0) ? "  " : ((i % 5 == 0) ? "a_token_longer_than_the_chunks" : "w"));
+    input.append((i % 3 == 0) ? " " : ",");
+  }
+  input.append(",,, ,");
+
+  CString::size_type chunkSizes[] = { 1, 2, 3, 7, 16, 33, 100000 };
+  CString::size_type maxReads[] = { 1, 5, 64 };
+  for(int c = 0; c < 7; c++)
+  {
+    for(int m = 0; m < 3; m++)
+    {
+      std::string::size_type position = 0;
+      CStringStreamTokenizer stream(makeReader(input, position, maxReads[m]), ", ", chunkSizes[c]);
+      CStringTokenizer whole(input.c_str(), ", ");
+      CString expected;
+      CString tokenStr;
+      int numTokens = 0;
+      do
+      {
+        expected = whole.next();
+        tokenStr = stream.next();
+        ASSERT_TRUE(tokenStr.equals(expected), tokenStr.str());
+        numTokens++;
+      } while(expected.size() > 0 || numTokens == 1);
+      ASSERT_TRUE(numTokens > 200, "stream tokens");
+      tokenStr = stream.next();
+      ASSERT_EQUALS(tokenStr.size(), 0, "stream end");
+    }
+  }
+
+  // Views and pointers, with an empty last token like CStringTokenizer
+  std::string lines("one\ntwo\n\nthree");
+  std::string::size_type position = 0;
+  CStringStreamTokenizer viewStream(makeReader(lines, position, 2), "\n", 4);
+  CStringView view;
+  ASSERT_TRUE(viewStream.next(view), "stream view");
+  ASSERT_TRUE(view.equals("one"), "stream view one");
+  CString kept = view.toCString();
+  ASSERT_TRUE(viewStream.next(view), "stream view 2");
+  ASSERT_TRUE(view.equals("two"), "stream view two");
+  ASSERT_TRUE(viewStream.next(view), "stream view 3");
+  ASSERT_TRUE(view.equals("three"), "stream view three");
+  ASSERT_FALSE(viewStream.next(view), "stream view end");
+  ASSERT_EQUALS(view.size(), 0, "stream view emptied");
+  ASSERT_TRUE(kept.equals("one"), "stream view kept");
+
+  position = 0;
+  CStringStreamTokenizer pointerStream(makeReader(lines, position, 3), "\n", 2);
+  const char *token;
+  CString::size_type length;
+  ASSERT_TRUE(pointerStream.next(token, length), "stream pointer");
+  ASSERT_TRUE(CString(token, length, 16u).equals("one"), "stream pointer one");
+  ASSERT_TRUE(pointerStream.next(token, length), "stream pointer 2");
+  ASSERT_TRUE(pointerStream.next(token, length), "stream pointer 3");
+  ASSERT_TRUE(CString(token, length, 16u).equals("three"), "stream pointer three");
+  ASSERT_FALSE(pointerStream.next(token, length), "stream pointer end");
+
+  // Empty input has 1 empty token, like CStringTokenizer
+  std::string empty;
+  position = 0;
+  CStringStreamTokenizer emptyStream(makeReader(empty, position, 8), " ");
+  ASSERT_TRUE(emptyStream.next(token, length), "empty stream token");
+  ASSERT_EQUALS(length, 0, "empty stream token length");
+  ASSERT_FALSE(emptyStream.next(token, length), "empty stream end");
+
+  // The buffer is reused, so memory doesnt grow with the input
+  std::string big;
+  for(int i = 0; i < 100000; i++)
+  {
+    big.append("token ");
+  }
+  position = 0;
+  CStringStreamTokenizer bigStream(makeReader(big, position, 1000), " ", 256);
+  int numTokens = 0;
+  while(bigStream.next(view))
+  {
+    numTokens++;
+  }
+  ASSERT_EQUALS(numTokens, 100000, "big stream tokens");
+  ASSERT_TRUE(bigStream.getBufferCapacity() <= 1024, "big stream buffer reused");
+
+  // A file descriptor
+  FILE *file = tmpfile();
+  ASSERT_TRUE(file != NULL, "tmpfile");
+  fputs("alpha beta\tgamma\n", file);
+  fflush(file);
+  lseek(fileno(file), 0, SEEK_SET);
+  CStringStreamTokenizer fdStream(fileno(file), " \t\n", 4);
+  CString tokenStr = fdStream.next();
+  ASSERT_TRUE(tokenStr.equals("alpha"), tokenStr.str());
+  tokenStr = fdStream.next();
+  ASSERT_TRUE(tokenStr.equals("beta"), tokenStr.str());
+  tokenStr = fdStream.next();
+  ASSERT_TRUE(tokenStr.equals("gamma"), tokenStr.str());
+  ASSERT_FALSE(fdStream.next(view), "fd stream end");
+  fclose(file);
+
+  // Read errors and bad arguments
+  CStringStreamTokenizer failing([](char *, CString::size_type) -> long { return -1; }, " ");
+  ASSERT_THROWS(failing.next(), CStringIOException, "stream read error");
+  ASSERT_THROWS(CStringStreamTokenizer(0, " ", 0), CStringInvalidArgException, "stream chunkSize 0");
 }
 
 // Tests that the capacity gets incremented at the correct times
@@ -586,16 +1831,227 @@ void testCapacity()
 
   str.replace("zyxwvutsrqpo", str.size()-1); // replace 1 with 12 => size = 61
   ASSERT_EQUALS(str.getCapacity(), 80, "Incorrect capacity, replace");
+
+  //
+  // Test growing a shared string, the other references keep the original
+  //
+  CString str2(str);
+  str.append("12345678901234567890"); // size = 81
+  ASSERT_EQUALS(str.getCapacity(), 100, "Incorrect capacity, shared append");
+  ASSERT_EQUALS(str2.getCapacity(), 80, "Incorrect capacity, shared original");
+  ASSERT_EQUALS(str2.size(), 61, "Incorrect size, shared original");
+  ASSERT_EQUALS(str.size(), 81, "Incorrect size, shared append");
+}
+
+void testGrowthPolicy()
+{
+  // Linear is the default and is tested in testCapacity()
+  ASSERT_EQUALS(CString::getDefaultGrowthPolicy(), CString::GROWTH_LINEAR, "default growth policy");
+
+  CString str(20);
+  str.setGrowthPolicy(CString::GROWTH_GEOMETRIC);
+  str.append("123456789012345678901"); // size = 21
+  ASSERT_EQUALS(str.getCapacity(), 40, "Incorrect capacity, geometric");
+  str.append("12345678901234567890"); // size = 41
+  ASSERT_EQUALS(str.getCapacity(), 80, "Incorrect capacity, geometric");
+  str.append('x', 0, true, 200); // size = 241, doubling isnt enough
+  ASSERT_EQUALS(str.getCapacity(), 241, "Incorrect capacity, geometric large append");
+
+  // The policy is copied along with the string
+  CString str2(str);
+  ASSERT_EQUALS(str2.getGrowthPolicy(), CString::GROWTH_GEOMETRIC, "copied growth policy");
+
+  CString str3(20);
+  str3.setGrowthPolicy(CString::GROWTH_EXACT);
+  str3.append("123456789012345678901"); // size = 21
+  ASSERT_EQUALS(str3.getCapacity(), 21, "Incorrect capacity, exact");
+
+  // New strings get the default policy
+  CString::setDefaultGrowthPolicy(CString::GROWTH_EXACT);
+  CString str4;
+  ASSERT_EQUALS(str4.getGrowthPolicy(), CString::GROWTH_EXACT, "new default growth policy");
+  CString::setDefaultGrowthPolicy(CString::GROWTH_LINEAR);
+
+  // reserve
+  CString str5;
+  str5.reserve(1000);
+  ASSERT_EQUALS(str5.getCapacity(), 1000, "Incorrect capacity, reserve");
+  str5.reserve(10);
+  ASSERT_EQUALS(str5.getCapacity(), 1000, "reserve should not reduce the capacity");
+
+  CString str6(5, false);
+  ASSERT_THROWS(str6.reserve(10), CStringOutOfBoundsException, "reserve with autoCapacity false");
+
+  // shrinkToFit
+  str5.append("A long string that isnt stored inline");
+  str5.shrinkToFit();
+  ASSERT_EQUALS(str5.getCapacity(), str5.size(), "Incorrect capacity, shrinkToFit");
+  ASSERT_TRUE(str5.equals("A long string that isnt stored inline"), str5.str());
+
+  TestCString tstr(str5);
+  tstr.remove(5);
+  tstr.shrinkToFit();
+  ASSERT_TRUE(tstr.isInline(), "shrinkToFit should move short strings inline");
+  ASSERT_TRUE(tstr.equals("A lon"), tstr.str());
+  ASSERT_EQUALS(tstr.getCapacity(), 5, "Incorrect capacity, shrinkToFit inline");
+}
+
+void testAllocatedBytes()
+{
+  // Inline strings dont allocate
+  CString str("inline");
+  ASSERT_EQUALS(str.getAllocatedBytes(), 0, "inline allocated bytes");
+
+  // Reserving allocates up front, pooled blocks are rounded up to their size class
+  str.reserve(1000);
+  ASSERT_EQUALS(str.getAllocatedBytes(), 2048, "reserved allocated bytes");
+  str.append("A string long enough not to be inline, but a lot shorter than the reserve");
+  ASSERT_EQUALS(str.getCapacity(), 1000, "appending within the reserve");
+  ASSERT_EQUALS(str.getAllocatedBytes(), 2048, "appending within the reserve");
+
+  // Shrinking releases the slack
+  str.remove(40);
+  str.shrinkToFit();
+  ASSERT_EQUALS(str.getCapacity(), 40, "shrinkToFit capacity");
+  ASSERT_EQUALS(str.getAllocatedBytes(), 128, "shrinkToFit allocated bytes");
+
+  // Shared data isnt shrunk, that would need a copy
+  str.reserve(100);
+  CString str2(str);
+  str.shrinkToFit();
+  ASSERT_EQUALS(str.getCapacity(), 100, "shared shrinkToFit capacity");
+
+  // Unless the string can go inline
+  str.remove(10);
+  str2.remove(10);
+  str2.shrinkToFit();
+  ASSERT_EQUALS(str2.getAllocatedBytes(), 0, "shrinkToFit to inline");
+
+  // autoCapacity false is a fixed capacity
+  CString str3(100, false);
+  str3.append("A string long enough not to be inline");
+  str3.shrinkToFit();
+  ASSERT_EQUALS(str3.getCapacity(), 100, "autoCapacity false shrinkToFit capacity");
+  ASSERT_THROWS(str3.reserve(200), CStringOutOfBoundsException, "autoCapacity false reserve");
+  ASSERT_NOT_THROWS(str3.reserve(50), "autoCapacity false reserve within the capacity");
+}
+
+void testArena()
+{
+  CStringArena arena(1024);
+  {
+    CString str(arena, "A string allocated in the arena");
+    TestCString tstr(str);
+    ASSERT_EQUALS(tstr.getDataArena(), &arena, "data should be in the arena");
+    CStringArena::size_type used = arena.getBytesUsed();
+    ASSERT_TRUE(used > str.getCapacity(), "arena should be used");
+
+    // The most recent allocation grows in place
+    CString str2(arena, "Another string in the arena", 32);
+    str2.append(", that grows");
+    ASSERT_TRUE(str2.equals("Another string in the arena, that grows"), str2.str());
+    ASSERT_EQUALS(str2.getCapacity(), 64, "arena string capacity");
+
+    // Growing an older allocation moves it
+    str.append(", and grows too");
+    ASSERT_TRUE(str.equals("A string allocated in the arena, and grows too"), str.str());
+    ASSERT_TRUE(tstr.equals("A string allocated in the arena"), tstr.str());
+
+    // Inline strings are promoted into the arena
+    TestCString tstr3(CString(arena, "short"));
+    ASSERT_TRUE(tstr3.isInline(), "short arena strings are inline");
+    tstr3.append(" until it isnt short anymore");
+    ASSERT_EQUALS(tstr3.getDataArena(), &arena, "promoted data should be in the arena");
+
+    // Substrings and tokens come from the same arena
+    TestCString tstr4(str.substr(2, 20));
+    ASSERT_EQUALS(tstr4.getDataArena(), &arena, "substr should be in the arena");
+    CStringTokenizer token(str, ",");
+    TestCString tstr5(token.next());
+    ASSERT_EQUALS(tstr5.getDataArena(), &arena, "token should be in the arena");
+    ASSERT_TRUE(tstr5.equals("A string allocated in the arena"), tstr5.str());
+
+    // Clones dont use the arena
+    TestCString tstr6(str.clone());
+    ASSERT_EQUALS(tstr6.getDataArena(), (CStringArena *) NULL, "clone should not be in the arena");
+
+    // Allocations bigger than the block size get their own block
+    CString str7(arena, 4096);
+    str7.append('x', 0, true, 2000);
+    ASSERT_EQUALS(str7.size(), 2000, "large arena string");
+    ASSERT_TRUE(arena.getBytesAllocated() > 4096, "large arena block");
+  }
+
+  arena.reset();
+  ASSERT_EQUALS(arena.getBytesUsed(), 0, "arena reset");
+  ASSERT_EQUALS(arena.getBytesAllocated(), 1024, "arena reset keeps the first block");
+
+  CString str8(arena, "The arena can be reused after a reset");
+  ASSERT_TRUE(str8.equals("The arena can be reused after a reset"), str8.str());
+}
+
+void testPool()
+{
+  CStringPool::trim();
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 0, "pool trimmed");
+
+  // Released blocks are reused by strings of the same size class
+  const char *ptr;
+  {
+    CString str("A pooled string that isnt inline");
+    ptr = str.str();
+  }
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 1, "block should be pooled");
+
+  CString str2("Another string of the same size class");
+  ASSERT_TRUE(str2.str() == ptr, "pooled block should be reused");
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 0, "block should be taken from the pool");
+
+  // Growing within the size class doesnt move the block,
+  // growing past it moves to the next size class
+  str2.reserve(CString::DEFAULT_CAPACITY + 10);
+  ASSERT_TRUE(str2.str() == ptr, "block should grow in its size class");
+  str2.reserve(1000);
+  ASSERT_FALSE(str2.str() == ptr, "block should move to a larger size class");
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 1, "smaller block should be pooled");
+  ASSERT_TRUE(str2.equals("Another string of the same size class"), str2.str());
+
+  // Blocks larger than MAX_BLOCK_SIZE arent pooled
+  str2.reserve(CStringPool::MAX_BLOCK_SIZE * 2);
+  str2.shrinkToFit();
+  ASSERT_TRUE(str2.equals("Another string of the same size class"), str2.str());
+  CStringPool::trim();
+  {
+    CString str3(CStringPool::MAX_BLOCK_SIZE * 2);
+    str3.append('x', 0, true, 100);
+  }
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 0, "large blocks arent pooled");
+
+  // The number of free blocks per size class is limited
+  CStringPool::setMaxFreeBlocks(2);
+  {
+    CString str4("A pooled string that isnt inline");
+    CString str5("A pooled string that isnt inline");
+    CString str6("A pooled string that isnt inline");
+    str5.append("!");
+    str6.append("!");
+  }
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 2, "max free blocks");
+  CStringPool::setMaxFreeBlocks(CStringPool::DEFAULT_MAX_FREE_BLOCKS);
+
+  CStringPool::trim();
+  ASSERT_EQUALS(CStringPool::getFreeBlocks(), 0, "pool trimmed");
 }
 
 void testReferenceCounting()
 {
-  CString *str1 = new CString("Test Str");
+  // These strings are longer than SMALL_CAPACITY so they are reference counted
+  CString *str1 = new CString("Test reference counted str");
   TestCString tstr1(*str1);
   ASSERT_EQUALS(tstr1.getReferences(), 2, "invalid num refs, copy ctor");
 
   // Test the the equals operator decrements the previous ref and increments the new ref
-  CString *str2 = new CString("another str");
+  CString *str2 = new CString("another reference counted str");
   TestCString tstr2(*str2);
   ASSERT_EQUALS(tstr2.getReferences(), 2, "invalid num refs, equals operator 2 refs");
   str2->operator=(*str1);
@@ -649,6 +2105,180 @@ void testReferenceCounting()
   ASSERT_EQUALS(tstr1.getReferences(), 1, "invalid num refs, method call pass by reference");
 }
 
+#ifndef SINGLE_THREADED
+// Copies and releases the shared string many times, used by testThreadedReferences
+void copyCstringManyTimes(const CString *str)
+{
+  for(int i = 0; i < 100000; i++)
+  {
+    CString copy(*str);
+    CStringIterator iter(copy);
+  }
+}
+
+void testThreadedReferences()
+{
+  CString *str = new CString("A string shared between threads");
+  TestCString tstr(*str);
+
+  std::vector<std::thread> threads;
+  for(int i = 0; i < 4; i++)
+  {
+    threads.push_back(std::thread(copyCstringManyTimes, str));
+  }
+
+  for(int i = 0; i < threads.size(); i++)
+  {
+    threads[i].join();
+  }
+
+  ASSERT_EQUALS(tstr.getReferences(), 2, "invalid num refs after threads");
+  delete str;
+  ASSERT_EQUALS(tstr.getReferences(), 1, "invalid num refs after delete");
+  ASSERT_TRUE(tstr.equals("A string shared between threads"), tstr.str());
+}
+#endif
+
+void testCopyOnWrite()
+{
+  CString str("The original shared string");
+  TestCString tstr(str);
+  ASSERT_EQUALS(tstr.getReferences(), 2, "copy should share the data");
+
+  // Each modification only affects the modified copy
+  tstr.append("!");
+  ASSERT_TRUE(str.equals("The original shared string"), str.str());
+  ASSERT_TRUE(tstr.equals("The original shared string!"), tstr.str());
+  ASSERT_EQUALS(tstr.getReferences(), 1, "append should detach");
+
+  TestCString tstr2(str);
+  tstr2.insert("xyz", 4);
+  tstr2.toupper();
+  ASSERT_TRUE(str.equals("The original shared string"), str.str());
+  ASSERT_TRUE(tstr2.equals("THE XYZORIGINAL SHARED STRING"), tstr2.str());
+
+  TestCString tstr3(str);
+  tstr3.remove(0, 4);
+  tstr3.replace("ORIG", 0, 4);
+  ASSERT_TRUE(str.equals("The original shared string"), str.str());
+  ASSERT_TRUE(tstr3.equals("ORIGinal shared string"), tstr3.str());
+
+  TestCString tstr4(str);
+  tstr4.tolower();
+  tstr4.clear();
+  ASSERT_TRUE(str.equals("The original shared string"), str.str());
+  ASSERT_EQUALS(tstr4.size(), 0, "clear shared size");
+
+  // Iterators keep the data they were created with
+  CString str2(str);
+  CStringIterator iter(str2);
+  str2.replace('X', 0, 1);
+  ASSERT_EQUALS(iter.next(), 'T', "iterator should keep its data");
+  ASSERT_TRUE(str2.equals("Xhe original shared string"), str2.str());
+
+  // A clone never shares the data
+  TestCString tstr5(str.clone());
+  ASSERT_EQUALS(tstr5.getReferences(), 1, "clone should not share the data");
+  ASSERT_TRUE(tstr5.equals(str), tstr5.str());
+  ASSERT_EQUALS(tstr5.getCapacity(), str.getCapacity(), "clone capacity");
+}
+
+void testMove()
+{
+  CString str("A string that is moved around");
+  TestCString tstr(str);
+  ASSERT_EQUALS(tstr.getReferences(), 2, "invalid num refs before move");
+
+  // Moving doesnt change the references
+  CString str2(std::move(str));
+  ASSERT_EQUALS(tstr.getReferences(), 2, "invalid num refs, move ctor");
+  ASSERT_TRUE(str2.equals("A string that is moved around"), str2.str());
+  ASSERT_TRUE(str.empty(), "moved from string should be empty");
+
+  // The moved from string can still be used
+  str.append("reused");
+  ASSERT_TRUE(str.equals("reused"), str.str());
+
+  CString str3("short");
+  str3 = std::move(str2);
+  ASSERT_EQUALS(tstr.getReferences(), 2, "invalid num refs, move assignment");
+  ASSERT_TRUE(str3.equals("A string that is moved around"), str3.str());
+  ASSERT_TRUE(str2.empty(), "move assigned from string should be empty");
+
+  // Inline strings
+  CString str4("inline");
+  CString str5(std::move(str4));
+  ASSERT_TRUE(str5.equals("inline"), str5.str());
+  ASSERT_TRUE(str4.empty(), "moved from inline string should be empty");
+
+  // Relocating in a vector doesnt touch the references
+  std::vector<CString> strings;
+  for(int i = 0; i < 100; i++)
+  {
+    strings.push_back(str3);
+  }
+  ASSERT_EQUALS(tstr.getReferences(), 102, "invalid num refs, vector");
+  strings.clear();
+  ASSERT_EQUALS(tstr.getReferences(), 2, "invalid num refs, vector cleared");
+
+  // operator= returns a reference, so assignments can be chained
+  CString str6, str7;
+  str6 = str7 = str3;
+  ASSERT_EQUALS(tstr.getReferences(), 4, "invalid num refs, chained assignment");
+
+  // Iterators
+  CStringIterator iter(str3);
+  CStringIterator iter2(std::move(iter));
+  ASSERT_FALSE(iter.isValid(), "moved from iterator should be invalid");
+  ASSERT_EQUALS(iter2.next(), 'A', "moved iterator");
+  iter = std::move(iter2);
+  ASSERT_EQUALS(iter.next(), ' ', "move assigned iterator");
+  ASSERT_EQUALS(tstr.getReferences(), 5, "invalid num refs, moved iterators");
+
+  // Tokenizer
+  CStringTokenizer token(str3, CStringTokenizer::whitespace);
+  ASSERT_TRUE(token.next().equals("A"), "tokenizer");
+  CStringTokenizer token2(std::move(token));
+  ASSERT_TRUE(token2.next().equals("string"), "moved tokenizer");
+  ASSERT_TRUE(token.next().empty(), "moved from tokenizer should be at the end");
+}
+
+void testSmallString()
+{
+  // Short strings are stored inline
+  CString str("0123456789");
+  TestCString tstr1(str);
+  ASSERT_TRUE(tstr1.isInline(), "short string should be inline");
+  ASSERT_EQUALS(str.getCapacity(), CString::DEFAULT_CAPACITY, "inline capacity");
+
+  // Modifying a copy of an inline string doesnt affect the original
+  tstr1.append("abcde"); // size = 15
+  ASSERT_TRUE(tstr1.isInline(), "string of SMALL_CAPACITY should be inline");
+  ASSERT_TRUE(str.equals("0123456789"), str.str());
+
+  // Growing past SMALL_CAPACITY promotes to the heap
+  tstr1.append("f", 3, false); // size = 18
+  ASSERT_FALSE(tstr1.isInline(), "long string should not be inline");
+  ASSERT_TRUE(tstr1.equals("0123456789abcdef  "), tstr1.str());
+  ASSERT_EQUALS(tstr1.size(), 18, "promoted size");
+  ASSERT_EQUALS(tstr1.getCapacity(), CString::DEFAULT_CAPACITY, "promoted capacity");
+
+  // Growing in the middle of an inline string
+  TestCString tstr2(CString("abcdefghijklmno"));
+  tstr2.replace("xyz", 1, 1);
+  ASSERT_FALSE(tstr2.isInline(), "replace should promote");
+  ASSERT_TRUE(tstr2.equals("axyzcdefghijklmno"), tstr2.str());
+
+  // Iterators over inline strings
+  CStringIterator iter(str);
+  ASSERT_EQUALS(iter.next(), '0', "inline iterator");
+
+  // The logical capacity is still enforced
+  CString str2(4, false);
+  ASSERT_NOT_THROWS(str2.append("1234"), "inline append within capacity");
+  ASSERT_THROWS(str2.append("5"), CStringOutOfBoundsException, "inline append past capacity");
+}
+
 void testExceptions()
 {
   CString str("This is a normal string");
@@ -777,24 +2407,64 @@ int main(int argc, char **argv)
 
     TEST_CASE(testReplace());
 
+    TEST_CASE(testReplaceAll());
+
     TEST_CASE(testRemove());
 
     TEST_CASE(testFind());
 
+    TEST_CASE(testFindAll());
+
+    TEST_CASE(testSearcher());
+
+    TEST_CASE(testMultiSearcher());
+
     TEST_CASE(testSubstr());
 
+    TEST_CASE(testSubstrView());
+
     TEST_CASE(testUpperLowerCase());
 
+    TEST_CASE(testIgnoreCase());
+
+    TEST_CASE(testHash());
+
+    TEST_CASE(testCompare());
+
     TEST_CASE(testIsNumber());
 
     TEST_CASE(testIterators());
 
     TEST_CASE(testTokenizer());
 
+    TEST_CASE(testStreamTokenizer());
+
+    TEST_CASE(testSplit());
+
+    TEST_CASE(testRecordSplitter());
+
     TEST_CASE(testCapacity());
 
+    TEST_CASE(testGrowthPolicy());
+
+    TEST_CASE(testAllocatedBytes());
+
+    TEST_CASE(testArena());
+
+    TEST_CASE(testPool());
+
     TEST_CASE(testReferenceCounting());
 
+#ifndef SINGLE_THREADED
+    TEST_CASE(testThreadedReferences());
+#endif
+
+    TEST_CASE(testSmallString());
+
+    TEST_CASE(testCopyOnWrite());
+
+    TEST_CASE(testMove());
+
     TEST_CASE(testExceptions());
 
     std::cout << "\nTests complete\n" << std::endl;